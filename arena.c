@@ -0,0 +1,110 @@
+/*      arena.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* Allocators shared by the program and libhexsed. Being library code
+ * these return NULL on failure and leave the reporting to the caller.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+#define HUGEPAGE (2 * 1024 * 1024)
+
+arena *ar_new(size_t chunksize)
+{	/* The arena lives for the run, eg all of an expression's strings.
+	 * Nothing handed out is zeroed.
+	*/
+	arena *ar = calloc(1, sizeof(arena));
+	if (!ar) return NULL;
+	ar->chunksize = chunksize;
+	return ar;
+} // ar_new()
+
+void *ar_alloc(arena *ar, size_t size)
+{
+	size = (size + 15) & ~(size_t)15;	// keep everything 16 aligned
+	archunk *ch = ar->head;
+	if (!ch || ch->size - ch->used < size) {
+		size_t want = (size > ar->chunksize) ? size : ar->chunksize;
+		ch = malloc(sizeof(archunk) + want);
+		if (!ch) return NULL;
+		ch->size = want;
+		ch->used = 0;
+		ch->next = ar->head;
+		ar->head = ch;
+	}
+	void *p = ch->mem + ch->used;
+	ch->used += size;
+	return p;
+} // ar_alloc()
+
+char *ar_strdup(arena *ar, const char *str)
+{
+	return ar_strndup(ar, str, strlen(str));
+} // ar_strdup()
+
+char *ar_strndup(arena *ar, const char *str, size_t len)
+{	/* copies exactly len bytes, embedded '\0' and all, and terminates */
+	char *p = ar_alloc(ar, len + 1);
+	if (!p) return NULL;
+	memcpy(p, str, len);
+	p[len] = '\0';
+	return p;
+} // ar_strndup()
+
+void ar_free(arena *ar)
+{
+	archunk *ch = ar->head;
+	while (ch) {
+		archunk *next = ch->next;
+		free(ch);
+		ch = next;
+	}
+	free(ar);
+} // ar_free()
+
+void *hugealloc(size_t size, size_t *mapped)
+{	/* Try explicit huge pages first, then ordinary pages with a
+	 * transparent huge page hint. The mapping is prefaulted here, once,
+	 * instead of page by page in the middle of the edit. mapped is what
+	 * hugefree() needs back.
+	*/
+	size_t len = (size + HUGEPAGE - 1) & ~(size_t)(HUGEPAGE - 1);
+	void *p = mmap(NULL, len, PROT_READ|PROT_WRITE,
+			MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0);
+	if (p == MAP_FAILED) {
+		p = mmap(NULL, len, PROT_READ|PROT_WRITE,
+				MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) return NULL;
+		madvise(p, len, MADV_HUGEPAGE);
+#ifdef MADV_POPULATE_WRITE
+		madvise(p, len, MADV_POPULATE_WRITE);
+#endif
+	}
+	*mapped = len;
+	return p;
+} // hugealloc()
+
+void hugefree(void *p, size_t mapped)
+{
+	munmap(p, mapped);
+} // hugefree()
@@ -0,0 +1,48 @@
+/*      arena.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _ARENA_H
+#define _ARENA_H
+#include <stddef.h>
+
+typedef struct archunk {
+	struct archunk *next;
+	size_t size;
+	size_t used;
+	char mem[];
+} archunk;
+
+typedef struct arena {
+	archunk *head;
+	size_t chunksize;
+} arena;
+
+arena *ar_new(size_t chunksize);
+void *ar_alloc(arena *ar, size_t size);
+char *ar_strdup(arena *ar, const char *str);
+char *ar_strndup(arena *ar, const char *str, size_t len);
+void ar_free(arena *ar);
+// Bump allocator, everything is released at once by ar_free().
+
+void *hugealloc(size_t size, size_t *mapped);
+void hugefree(void *p, size_t mapped);
+// Large page backed memory for the I/O blocks, see arena.c
+
+#endif
@@ -0,0 +1,312 @@
+/*      carve.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* hexsed --carve, and the split ops b and e, each cutting the input into
+ * files of its own.
+ *
+ * --carve makes one pass through the input, a block at a time, looking
+ * for a start marker, then for the end marker after it, then for the
+ * next start. A marker may straddle two blocks, so the last bytes of each
+ * block that could begin one are searched again with the next. Nothing
+ * is kept of the regions found but their offsets: from a regular file
+ * each is copied with copy_file_range(), so its bytes are only read the
+ * once, to search them, and the copy shares the extents where the fs
+ * can. From a pipe the region is written out as it is read.
+ *
+ * The split ops have libhexsed find the cuts, and the pieces between
+ * are copied the same way. Only the file being written is ever open.
+*/
+
+#include "fileops.h"
+#include "stringops.h"
+#include "libhexsed.h"
+#include "carve.h"
+
+typedef struct carver {
+	int ifd;
+	int seek;	// a regular file, regions are copied from it
+	const char *tmpl;
+	char *mark[2];	// start, end
+	size_t mlen[2];
+	int in;	// in a region, looking for its end
+	off_t rstart;	// where the region began
+	int ofd;	// from a pipe, the region being written
+	char name[PATH_MAX];
+	unsigned long n;	// regions so far
+} carver;
+
+typedef struct splitter {
+	int ifd;
+	int seek;	// a regular file, pieces are copied from it
+	const char *tmpl;
+	int after;	// op e, the cut follows the match
+	off_t start;	// of the piece not yet written
+	off_t out;	// from a pipe, bytes out so far
+	off_t cut;	// from a pipe, the cut they've to reach, or -1
+	int ofd;	// from a pipe, the piece being written
+	char name[PATH_MAX];
+	unsigned long n;	// pieces so far
+} splitter;
+
+static void opened(carver *cv, off_t at);
+static void closed(carver *cv, off_t end);
+static int oncut(void *ctx, off_t at, const char *found, size_t mlen);
+static int splitsink(void *ctx, const char *from, size_t len);
+static void piece(splitter *sp, off_t end);
+
+void carve(const char *fn, const char *markers, const char *tmpl,
+			int quiet)
+{
+	carver cv;
+	memset(&cv, 0, sizeof(cv));
+	if (checkname(tmpl)) {
+		fprintf(stderr, "A name template needs just one %%d: %s\n", tmpl);
+		exit(EXIT_FAILURE);
+	}
+	cv.tmpl = tmpl;
+	char *cp = dostrdup(markers);
+	char *slash = strchr(cp, '/');
+	if (!slash) {
+		fprintf(stderr, "--carve wants start/end, in hex: %s\n", markers);
+		exit(EXIT_FAILURE);
+	}
+	*slash = '\0';
+	cv.mark[0] = hexbytes(cp, &cv.mlen[0], "--carve start");
+	cv.mark[1] = hexbytes(slash + 1, &cv.mlen[1], "--carve end");
+	free(cp);
+	cv.ifd = (strcmp(fn, "-") == 0) ? 0 : doopen(fn, "r");
+	struct stat sb;
+	cv.seek = (fstat(cv.ifd, &sb) == 0 && S_ISREG(sb.st_mode));
+	cv.ofd = -1;
+	if (cv.seek) posix_fadvise(cv.ifd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	size_t keep = ((cv.mlen[0] > cv.mlen[1]) ? cv.mlen[0] : cv.mlen[1]) - 1;
+	char *buf = domalloc(CARVE_BLOCK + keep, "carve()");
+	size_t have = 0, pos = 0;	// bytes in buf, and searched
+	size_t w = 0;	// from a pipe, region bytes before this are out
+	off_t base = 0;	// input offset of buf[0]
+	while (1) {
+		ssize_t res = read(cv.ifd, buf + have, CARVE_BLOCK);
+		if (res == -1 && errno == EINTR) continue;
+		if (res == -1) {
+			perror(fn);
+			exit(EXIT_FAILURE);
+		}
+		have += res;
+		while (1) {
+			size_t ml = cv.mlen[cv.in];
+			char *q = memmem(buf + pos, have - pos, cv.mark[cv.in], ml);
+			if (!q) break;
+			size_t at = q - buf;
+			if (!cv.in) {
+				opened(&cv, base + at);
+				w = at;
+			} else {
+				if (!cv.seek) writeall(cv.ofd, buf + w, at + ml - w);
+				closed(&cv, base + at + ml);
+			}
+			pos = at + ml;
+		}
+		if (res == 0) break;
+		// a marker can only start in the last ml - 1 bytes still
+		size_t ml = cv.mlen[cv.in];
+		if (have - pos >= ml) pos = have - (ml - 1);
+		if (cv.in && !cv.seek) writeall(cv.ofd, buf + w, pos - w);
+		memmove(buf, buf + pos, have - pos);
+		base += pos;
+		have -= pos;
+		pos = w = 0;
+	}
+	if (cv.in) {	// no end to it, so not a region
+		if (!cv.seek) {
+			doclose(cv.ofd);
+			unlink(cv.name);
+		}
+		if (!quiet) fprintf(stderr, "Start marker at %lld never ended.\n",
+							(long long)cv.rstart);
+	}
+	free(buf);
+	free(cv.mark[0]);
+	free(cv.mark[1]);
+	if (cv.ifd) doclose(cv.ifd);
+	if (!quiet) fprintf(stdout, "Carved %lu regions.\n", cv.n);
+} // carve()
+
+static void opened(carver *cv, off_t at)
+{	/* a start marker at offset at */
+	cv->in = 1;
+	cv->rstart = at;
+	outname(cv->tmpl, cv->n + 1, cv->name, sizeof(cv->name));
+	if (!cv->seek) cv->ofd = doopen(cv->name, "w");
+} // opened()
+
+static void closed(carver *cv, off_t end)
+{	/* the end marker finishes at offset end */
+	if (cv->seek) {
+		cv->ofd = doopen(cv->name, "w");
+		copyrange(cv->ifd, cv->rstart, cv->ofd, end - cv->rstart);
+	}
+	doclose(cv->ofd);
+	cv->ofd = -1;
+	cv->in = 0;
+	cv->n++;
+} // closed()
+
+void split(const char *fn, const hx_program *prog, const char *tmpl,
+			int quiet)
+{
+	splitter sp;
+	memset(&sp, 0, sizeof(sp));
+	if (checkname(tmpl)) {
+		fprintf(stderr, "A name template needs just one %%d: %s\n", tmpl);
+		exit(EXIT_FAILURE);
+	}
+	sp.tmpl = tmpl;
+	sp.after = (hx_op(prog) == 'e');
+	sp.ifd = (strcmp(fn, "-") == 0) ? 0 : doopen(fn, "r");
+	struct stat sb;
+	sp.seek = (fstat(sp.ifd, &sb) == 0 && S_ISREG(sb.st_mode));
+	sp.cut = -1;
+	sp.ofd = -1;
+	if (sp.seek) posix_fadvise(sp.ifd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	hx_stream *st;
+	int res = hx_stream_new(prog, splitsink, &sp, &st);
+	if (res != HX_OK) {
+		fprintf(stderr, "%s\n", hx_strerror(res));
+		exit(EXIT_FAILURE);
+	}
+	hx_stream_matches(st, oncut, &sp);
+	char *buf = domalloc(CARVE_BLOCK, "split()");
+	off_t total = 0;
+	while (1) {
+		ssize_t n = read(sp.ifd, buf, CARVE_BLOCK);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) {
+			perror(fn);
+			exit(EXIT_FAILURE);
+		}
+		if (n == 0) break;
+		total += n;
+		hx_feed(st, buf, n);	// oncut() and splitsink() don't fail
+	}
+	hx_flush(st);
+	if (sp.seek) {
+		piece(&sp, total);
+	} else if (sp.ofd != -1) {
+		doclose(sp.ofd);
+	}
+	hx_stream_free(st);
+	free(buf);
+	if (sp.ifd) doclose(sp.ifd);
+	if (!quiet) fprintf(stdout, "Split into %lu files.\n", sp.n);
+} // split()
+
+static int oncut(void *ctx, off_t at, const char *found, size_t mlen)
+{	/* Called before any of the match goes to the sink. From a file what
+	 * lies before the cut is there to copy now, from a pipe the sink
+	 * will close the piece on reaching the cut.
+	*/
+	(void)found;
+	splitter *sp = ctx;
+	off_t cut = at + (sp->after ? (off_t)mlen : 0);
+	if (sp->seek) {
+		piece(sp, cut);
+	} else if (cut == sp->out) {
+		if (sp->ofd != -1) doclose(sp->ofd);
+		sp->ofd = -1;
+	} else {
+		sp->cut = cut;
+	}
+	return 0;
+} // oncut()
+
+static int splitsink(void *ctx, const char *from, size_t len)
+{	/* From a pipe, the output is the input unchanged, into the piece it
+	 * belongs to. Only hx_feed() is used, so from is never NULL.
+	*/
+	splitter *sp = ctx;
+	if (sp->seek) return 0;
+	while (len) {
+		size_t n = len;
+		if (sp->cut != -1 && sp->out + (off_t)n > sp->cut)
+			n = sp->cut - sp->out;
+		if (n && sp->ofd == -1) {
+			outname(sp->tmpl, ++sp->n, sp->name, sizeof(sp->name));
+			sp->ofd = doopen(sp->name, "w");
+		}
+		writeall(sp->ofd, from, n);
+		from += n;
+		len -= n;
+		sp->out += n;
+		if (sp->out == sp->cut) {
+			doclose(sp->ofd);
+			sp->ofd = -1;
+			sp->cut = -1;
+		}
+	}
+	return 0;
+} // splitsink()
+
+static void piece(splitter *sp, off_t end)
+{	/* from a file, what is left before end as the next piece */
+	if (end <= sp->start) return;
+	outname(sp->tmpl, ++sp->n, sp->name, sizeof(sp->name));
+	int ofd = doopen(sp->name, "w");
+	copyrange(sp->ifd, sp->start, ofd, end - sp->start);
+	doclose(ofd);
+	sp->start = end;
+} // piece()
+
+int checkname(const char *tmpl)
+{
+	int convs = 0;
+	const char *cp;
+	for (cp = tmpl; *cp; cp++) {
+		if (*cp != '%') continue;
+		cp++;
+		if (*cp == '%') continue;
+		while (isdigit(*cp)) cp++;
+		if (*cp != 'd') return -1;
+		convs++;
+	}
+	return (convs == 1) ? 0 : -1;
+} // checkname()
+
+void outname(const char *tmpl, unsigned long n, char *name, size_t size)
+{	/* tmpl has passed checkname(), so the %d can become %lu */
+	char fmt[PATH_MAX];
+	const char *d = tmpl;
+	while (1) {
+		d = strchr(d, '%');
+		if (d[1] != '%') break;
+		d += 2;
+	}
+	d = strchr(d, 'd');
+	if ((size_t)(d - tmpl) + strlen(d) + 2 > sizeof(fmt)) {
+		fprintf(stderr, "Name template too long: %s\n", tmpl);
+		exit(EXIT_FAILURE);
+	}
+	memcpy(fmt, tmpl, d - tmpl);
+	sprintf(fmt + (d - tmpl), "lu%s", d + 1);
+	if ((size_t)snprintf(name, size, fmt, n) >= size) {
+		fprintf(stderr, "Name too long: %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+} // outname()
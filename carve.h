@@ -0,0 +1,43 @@
+/*      carve.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _CARVE_H
+#define _CARVE_H
+#include <stddef.h>
+#include "libhexsed.h"
+
+#define CARVE_BLOCK (1024 * 1024)	// read and searched at a time
+
+void carve(const char *fn, const char *markers, const char *tmpl,
+			int quiet);
+// --carve start/end, every region from a start marker to the end marker
+// after it, both included, to a file of its own named by tmpl.
+
+void split(const char *fn, const hx_program *prog, const char *tmpl,
+			int quiet);
+// The ops /find/b and /find/e, the input in pieces, each to a file of its
+// own named by tmpl, cut before or after every match.
+
+int checkname(const char *tmpl);
+void outname(const char *tmpl, unsigned long n, char *name, size_t size);
+// A name template has one %d, with a width and 0 fill if wanted, for the
+// output's number, counting from 1. checkname() is 0 if tmpl will do.
+
+#endif
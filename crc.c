@@ -0,0 +1,135 @@
+/*      crc.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <pthread.h>
+#include "crc.h"
+
+#define POLY 0x82F63B78	// 0x1EDC6F41 reflected
+
+static uint32_t table[8][256];
+static uint32_t x2n[64];	// x^(2^n) mod POLY
+static int hw;	// the cpu has the SSE4.2 crc32 instruction
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void mktable(void);
+static uint32_t multmodp(uint32_t a, uint32_t b);
+static uint32_t crcsw(uint32_t crc, const unsigned char *p, size_t len);
+#if defined(__x86_64__)
+static uint32_t crchw(uint32_t crc, const unsigned char *p, size_t len);
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *from, size_t len)
+{
+	pthread_once(&once, mktable);
+#if defined(__x86_64__)
+	if (hw) return ~crchw(~crc, from, len);
+#endif
+	return ~crcsw(~crc, from, len);
+} // crc32c()
+
+uint32_t crc32c_zeros(uint32_t crc, uint64_t len)
+{	/* Appending a 0x00 byte multiplies the crc by x^8 mod POLY, so len
+	 * of them by x^(8 * len), made up from the powers in x2n.
+	*/
+	pthread_once(&once, mktable);
+	uint32_t p = 1u << 31;	// x^0
+	int k = 3;
+	for (; len; len >>= 1, k++) {
+		if (len & 1) p = multmodp(x2n[k & 63], p);
+	}
+	return ~multmodp(p, ~crc);
+} // crc32c_zeros()
+
+static uint32_t crcsw(uint32_t crc, const unsigned char *p, size_t len)
+{	/* slice by 8, a word at a time where it is lined up */
+	while (len && ((uintptr_t)p & 7)) {
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (len >= 8) {
+		uint64_t w = *(const uint64_t *)p ^ crc;
+		crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff] ^
+				table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff] ^
+				table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff] ^
+				table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+		p += 8;
+		len -= 8;
+	}
+#endif
+	while (len--) crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+} // crcsw()
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crchw(uint32_t crc, const unsigned char *p, size_t len)
+{	/* Three streams at once would hide the instruction's latency, one
+	 * is already well past the speed anything here reads at.
+	*/
+	uint64_t c = crc;
+	while (len && ((uintptr_t)p & 7)) {
+		c = __builtin_ia32_crc32qi(c, *p++);
+		len--;
+	}
+	while (len >= 8) {
+		c = __builtin_ia32_crc32di(c, *(const uint64_t *)p);
+		p += 8;
+		len -= 8;
+	}
+	while (len--) c = __builtin_ia32_crc32qi(c, *p++);
+	return c;
+} // crchw()
+#endif
+
+static void mktable(void)
+{
+	uint32_t i, j;
+#if defined(__x86_64__)
+	hw = __builtin_cpu_supports("sse4.2");
+#endif
+	x2n[0] = 1u << 30;	// x^1
+	for (i = 1; i < 64; i++) x2n[i] = multmodp(x2n[i - 1], x2n[i - 1]);
+	for (i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (j = 0; j < 8; j++) c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+		table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			table[j][i] = table[0][table[j - 1][i] & 0xff] ^
+							(table[j - 1][i] >> 8);
+		}
+	}
+} // mktable()
+
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{	/* a * b mod POLY, bit reflected so x^0 is the top bit */
+	uint32_t m = 1u << 31, p = 0;
+	while (1) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ POLY : b >> 1;
+	}
+	return p;
+} // multmodp()
@@ -0,0 +1,32 @@
+/*      crc.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _CRC_H
+#define _CRC_H
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c(uint32_t crc, const void *from, size_t len);
+uint32_t crc32c_zeros(uint32_t crc, uint64_t len);
+// CRC32C, Castagnoli. Start from 0 and pass the result back in to carry
+// on over more data. crc32c_zeros() carries on over len 0x00 bytes, a
+// hole say, without looking at them.
+
+#endif
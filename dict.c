@@ -0,0 +1,596 @@
+/*      dict.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libhexsed.h"
+#include "dict.h"
+
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+#define BIT(map, i) ((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define SETBIT(map, i) ((map)[(i) >> 3] |= (1 << ((i) & 7)))
+#define TRIMIN 12
+#define TRIMAX 24
+#define MAXTRIES 16	// a free slot that won't take a first child
+						// this often is passed over from then on
+
+typedef struct key {
+	const unsigned char *p;
+	uint32_t len;
+} key;
+
+typedef struct work {	// a node still to be given its children
+	int32_t s;
+	uint32_t lo;
+	uint32_t hi;
+	uint32_t depth;
+} work;
+
+typedef struct builder {
+	dtrie *dt;
+	size_t cap;
+	int32_t *nxt;	// circular list of the free slots
+	int32_t *prv;
+	uint8_t *tries;	// failures per free slot, MAXTRIES once dropped
+	int32_t head;	// -1 when there are none
+	size_t tailcap;
+} builder;
+
+static int readlist(const char *path, key **keys, size_t *nkeys,
+					unsigned char **bytes);
+static int hexval(int c);
+static int fromkeys(dtrie *dt, key *keys, size_t nkeys);
+static int keycmp(const void *a, const void *b);
+static int build(dtrie *dt, const key *keys, size_t nkeys);
+static int grow(builder *bd, size_t need);
+static void unlink_free(builder *bd, int32_t x);
+static void occupy(builder *bd, int32_t x, int32_t parent);
+static int32_t findbase(builder *bd, const int *codes, int n);
+static int addtail(builder *bd, int32_t s, const unsigned char *p,
+					uint32_t len);
+static uint32_t trihash(unsigned b0, unsigned b1, unsigned b2,
+						uint32_t bits);
+static size_t longest(const dview *dv, const unsigned char *p,
+						size_t avail);
+
+int dt_build(const char *path, dtrie *dt)
+{	/* Patterns are one per line in hex, blank lines, white space and
+	 * lines starting with '#' are ignored. Duplicates are dropped.
+	*/
+	memset(dt, 0, sizeof(dtrie));
+	key *keys = NULL;
+	unsigned char *bytes = NULL;
+	size_t nkeys = 0;
+	int res = readlist(path, &keys, &nkeys, &bytes);
+	if (res == HX_OK) res = fromkeys(dt, keys, nkeys);
+	free(keys);
+	free(bytes);
+	return res;
+} // dt_build()
+
+int dt_build_mem(const unsigned char *bytes, const uint32_t *lens,
+					size_t n, dtrie *dt)
+{
+	memset(dt, 0, sizeof(dtrie));
+	key *keys = malloc((n ? n : 1) * sizeof(key));
+	if (!keys) return HX_ENOMEM;
+	size_t i;
+	for (i = 0; i < n; i++) {
+		keys[i].p = bytes;
+		keys[i].len = lens[i];
+		bytes += lens[i];
+	}
+	int res = fromkeys(dt, keys, n);
+	free(keys);
+	return res;
+} // dt_build_mem()
+
+static int fromkeys(dtrie *dt, key *keys, size_t nkeys)
+{	/* the trie of keys, which get sorted and have duplicates dropped */
+	int res = HX_OK;
+	if (nkeys == 0) return HX_EZEROFIND;
+	qsort(keys, nkeys, sizeof(key), keycmp);
+	size_t i, n = 1;
+	for (i = 1; i < nkeys; i++) {	// sorted, so duplicates are adjacent
+		if (keycmp(&keys[i], &keys[n - 1])) keys[n++] = keys[i];
+	}
+	nkeys = n;
+	dt->npat = nkeys;
+	uint32_t bits = TRIMIN;
+	while (bits < TRIMAX && ((size_t)1 << bits) < 8 * nkeys) bits++;
+	dt->tribits = bits;
+	dt->tri = calloc(((size_t)1 << bits) / 8, 1);
+	if (!dt->tri) {
+		res = HX_ENOMEM;
+		goto done;
+	}
+	for (i = 0; i < nkeys; i++) {
+		const unsigned char *p = keys[i].p;
+		uint32_t len = keys[i].len;
+		if (len > dt->maxlen) dt->maxlen = len;
+		if (!dt->minlen || len < dt->minlen) dt->minlen = len;
+		if (len == 1) SETBIT(dt->one, p[0]);
+		else if (len == 2) SETBIT(dt->pair, p[0] << 8 | p[1]);
+		else SETBIT(dt->tri, trihash(p[0], p[1], p[2], bits));
+		uint32_t j = 0;
+		while (j < len && !p[j]) j++;
+		if (j == len) dt->allzero = 1;
+	}
+	res = build(dt, keys, nkeys);
+done:
+	if (res != HX_OK) dt_free(dt);
+	return res;
+} // fromkeys()
+
+void dt_free(dtrie *dt)
+{
+	free(dt->base);
+	free(dt->check);
+	free(dt->term);
+	free(dt->tail);
+	free(dt->tri);
+	memset(dt, 0, sizeof(dtrie));
+} // dt_free()
+
+size_t dt_size(const dtrie *dt)
+{	/* bytes dt_place() will use, each section 8 byte aligned */
+	return 2 * ALIGN8(dt->nnodes * sizeof(int32_t))
+			+ ALIGN8((dt->nnodes + 7) / 8)
+			+ sizeof(dt->one) + sizeof(dt->pair)
+			+ ALIGN8(((size_t)1 << dt->tribits) / 8)
+			+ ALIGN8(dt->taillen);
+} // dt_size()
+
+void dt_place(const dtrie *dt, char *image, uint64_t off, dictsec *sec)
+{	/* off must be 8 byte aligned */
+	memset(sec, 0, sizeof(dictsec));
+	sec->npat = dt->npat;
+	sec->nnodes = dt->nnodes;
+	sec->tribits = dt->tribits;
+	sec->taillen = dt->taillen;
+	sec->baseoff = off;
+	memcpy(image + off, dt->base, dt->nnodes * sizeof(int32_t));
+	off += ALIGN8(dt->nnodes * sizeof(int32_t));
+	sec->checkoff = off;
+	memcpy(image + off, dt->check, dt->nnodes * sizeof(int32_t));
+	off += ALIGN8(dt->nnodes * sizeof(int32_t));
+	sec->termoff = off;
+	memcpy(image + off, dt->term, (dt->nnodes + 7) / 8);
+	off += ALIGN8((dt->nnodes + 7) / 8);
+	sec->oneoff = off;
+	memcpy(image + off, dt->one, sizeof(dt->one));
+	off += sizeof(dt->one);
+	sec->pairoff = off;
+	memcpy(image + off, dt->pair, sizeof(dt->pair));
+	off += sizeof(dt->pair);
+	sec->trioff = off;
+	memcpy(image + off, dt->tri, ((size_t)1 << dt->tribits) / 8);
+	off += ALIGN8(((size_t)1 << dt->tribits) / 8);
+	sec->tailoff = off;
+	if (dt->taillen) memcpy(image + off, dt->tail, dt->taillen);
+} // dt_place()
+
+int dt_check(const dictsec *sec, uint64_t size)
+{	/* Non zero unless every section lies inside an image of size bytes.
+	 * What is inside the sections is checked as it is used, a damaged
+	 * trie gives wrong answers but never reads outside the image.
+	*/
+	if (sec->nnodes == 0 || sec->nnodes > INT32_MAX) return 1;
+	if (sec->tribits < TRIMIN || sec->tribits > TRIMAX) return 1;
+	struct { uint64_t off, len, align; } part[] = {
+		{ sec->baseoff, sec->nnodes * sizeof(int32_t), 4 },
+		{ sec->checkoff, sec->nnodes * sizeof(int32_t), 4 },
+		{ sec->termoff, (sec->nnodes + 7) / 8, 1 },
+		{ sec->oneoff, 32, 1 },
+		{ sec->pairoff, 8192, 1 },
+		{ sec->trioff, ((uint64_t)1 << sec->tribits) / 8, 1 },
+		{ sec->tailoff, sec->taillen, 1 },
+	};
+	size_t i;
+	for (i = 0; i < sizeof(part) / sizeof(part[0]); i++) {
+		if (part[i].off % part[i].align) return 1;
+		if (part[i].off > size || part[i].len > size - part[i].off)
+			return 1;
+	}
+	return 0;
+} // dt_check()
+
+void dt_view(const char *image, const dictsec *sec, dview *dv)
+{
+	dv->base = (const int32_t *)(image + sec->baseoff);
+	dv->check = (const int32_t *)(image + sec->checkoff);
+	dv->term = (const uint8_t *)(image + sec->termoff);
+	dv->nnodes = sec->nnodes;
+	dv->one = (const uint8_t *)(image + sec->oneoff);
+	dv->pair = (const uint8_t *)(image + sec->pairoff);
+	dv->tri = (const uint8_t *)(image + sec->trioff);
+	dv->tribits = sec->tribits;
+	dv->tail = (const unsigned char *)(image + sec->tailoff);
+	dv->taillen = sec->taillen;
+} // dt_view()
+
+const char *dt_next(const dview *dv, const char *from, size_t pos,
+					size_t limit, size_t len, size_t *mlen)
+{	/* The bitmaps decide whether a position is worth walking the trie
+	 * from, only the 3 byte one can say yes wrongly.
+	*/
+	const unsigned char *p = (const unsigned char *)from;
+	for (; pos < limit; pos++) {
+		size_t avail = len - pos;
+		unsigned b0 = p[pos];
+		int cand = BIT(dv->one, b0);
+		if (!cand && avail >= 2) {
+			unsigned b1 = p[pos + 1];
+			cand = BIT(dv->pair, b0 << 8 | b1);
+			if (!cand && avail >= 3) {
+				uint32_t h = trihash(b0, b1, p[pos + 2], dv->tribits);
+				cand = BIT(dv->tri, h);
+			}
+		}
+		if (cand) {
+			size_t n = longest(dv, p + pos, avail);
+			if (n) {
+				*mlen = n;
+				return from + pos;
+			}
+		}
+	}
+	return NULL;
+} // dt_next()
+
+static size_t longest(const dview *dv, const unsigned char *p,
+						size_t avail)
+{	/* length of the longest pattern p starts with, 0 for none */
+	uint64_t s = 0;
+	size_t d = 0, best = 0;
+	while (1) {
+		if (BIT(dv->term, s)) best = d;
+		int32_t b = dv->base[s];
+		if (b < 0) {	// one pattern left, the rest of it is a tail
+			uint64_t off = -(int64_t)b - 1;
+			uint32_t tl;
+			if (off > dv->taillen || dv->taillen - off < sizeof(tl)) break;
+			memcpy(&tl, dv->tail + off, sizeof(tl));
+			off += sizeof(tl);
+			if (tl > dv->taillen - off) break;
+			if (avail - d >= tl && memcmp(p + d, dv->tail + off, tl) == 0)
+				best = d + tl;
+			break;
+		}
+		if (d == avail) break;
+		uint64_t t = (uint64_t)b + p[d] + 1;
+		if (t >= dv->nnodes || (uint64_t)dv->check[t] != s + 1) break;
+		s = t;
+		d++;
+	}
+	return best;
+} // longest()
+
+int dt_partial(const dview *dv, const char *p, size_t avail)
+{	/* walk p, a match is still possible if it runs out before the trie */
+	const unsigned char *u = (const unsigned char *)p;
+	uint64_t s = 0;
+	size_t d = 0;
+	while (d < avail) {
+		int32_t b = dv->base[s];
+		if (b < 0) {
+			uint64_t off = -(int64_t)b - 1;
+			uint32_t tl;
+			if (off > dv->taillen || dv->taillen - off < sizeof(tl)) return 0;
+			memcpy(&tl, dv->tail + off, sizeof(tl));
+			off += sizeof(tl);
+			if (tl > dv->taillen - off || tl <= avail - d) return 0;
+			return memcmp(u + d, dv->tail + off, avail - d) == 0;
+		}
+		uint64_t t = (uint64_t)b + u[d] + 1;
+		if (t >= dv->nnodes || (uint64_t)dv->check[t] != s + 1) return 0;
+		s = t;
+		d++;
+	}
+	if (dv->base[s] < 0) return 1;	// tails are never empty
+	int c;
+	for (c = 1; c <= 256; c++) {	// any child at all?
+		uint64_t t = (uint64_t)dv->base[s] + c;
+		if (t < dv->nnodes && (uint64_t)dv->check[t] == s + 1) return 1;
+	}
+	return 0;
+} // dt_partial()
+
+static uint32_t trihash(unsigned b0, unsigned b1, unsigned b2,
+						uint32_t bits)
+{
+	uint32_t v = (b0 << 16) | (b1 << 8) | b2;
+	return (v * 0x9E3779B1u) >> (32 - bits);
+} // trihash()
+
+static int readlist(const char *path, key **keys, size_t *nkeys,
+					unsigned char **bytes)
+{	/* The patterns go into bytes, which is never more than half the
+	 * size of the file, keys point into it.
+	*/
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return HX_EIO;
+	struct stat sb;
+	if (fstat(fd, &sb) == -1) {
+		close(fd);
+		return HX_EIO;
+	}
+	if (sb.st_size == 0) {
+		close(fd);
+		return HX_OK;
+	}
+	char *map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return HX_EIO;
+	madvise(map, sb.st_size, MADV_SEQUENTIAL);
+	int res = HX_OK;
+	size_t kcap = 0;
+	unsigned char *out = malloc(sb.st_size / 2 + 1);
+	*bytes = out;
+	if (!out) res = HX_ENOMEM;
+	const char *cp = map, *end = map + sb.st_size;
+	while (res == HX_OK && cp < end) {
+		const char *eol = memchr(cp, '\n', end - cp);
+		if (!eol) eol = end;
+		const unsigned char *start = out;
+		int hi = -1;
+		while (cp < eol && isspace((unsigned char)*cp)) cp++;
+		if (cp < eol && *cp != '#') {
+			for (; cp < eol; cp++) {
+				if (isspace((unsigned char)*cp)) continue;
+				int v = hexval(*cp);
+				if (v == -1) {
+					res = HX_EHEX;
+					break;
+				}
+				if (hi == -1) {
+					hi = v;
+				} else {
+					*out++ = hi << 4 | v;
+					hi = -1;
+				}
+			}
+		}
+		cp = eol + 1;
+		if (res != HX_OK) break;
+		if (hi != -1) {
+			res = HX_EPAIR;
+			break;
+		}
+		if (out == start) continue;	// blank or a comment
+		if (*nkeys == kcap) {
+			kcap = kcap ? 2 * kcap : 1024;
+			key *k = realloc(*keys, kcap * sizeof(key));
+			if (!k) {
+				res = HX_ENOMEM;
+				break;
+			}
+			*keys = k;
+		}
+		(*keys)[*nkeys].p = start;
+		(*keys)[*nkeys].len = out - start;
+		(*nkeys)++;
+	}
+	munmap(map, sb.st_size);
+	return res;
+} // readlist()
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+} // hexval()
+
+static int keycmp(const void *a, const void *b)
+{	/* byte order, a prefix sorts before what it is a prefix of */
+	const key *x = a, *y = b;
+	uint32_t n = (x->len < y->len) ? x->len : y->len;
+	int r = memcmp(x->p, y->p, n);
+	if (r) return r;
+	return (x->len > y->len) - (x->len < y->len);
+} // keycmp()
+
+static int build(dtrie *dt, const key *keys, size_t nkeys)
+{	/* Depth first over the sorted keys. A node covers the range of keys
+	 * sharing its prefix, its children are the distinct next bytes, coded
+	 * as byte + 1 so no child lands on its parent's base.
+	*/
+	builder bd = { dt, 0, NULL, NULL, NULL, -1, 0 };
+	int res = HX_ENOMEM;
+	size_t wcap = 1024, nw = 0;
+	work *stack = malloc(wcap * sizeof(work));
+	if (!stack || grow(&bd, 1024)) goto done;
+	occupy(&bd, 0, -2);	// the root, never anyone's child
+	dt->nnodes = 1;
+	stack[nw++] = (work){ 0, 0, nkeys, 0 };
+	int codes[256];
+	uint32_t ends[256];
+	while (nw) {
+		work w = stack[--nw];
+		uint32_t lo = w.lo;
+		if (keys[lo].len == w.depth) {	// a prefix sorts first
+			SETBIT(dt->term, w.s);
+			lo++;
+		}
+		if (lo == w.hi) continue;	// a leaf
+		if (w.hi - lo == 1) {
+			if (addtail(&bd, w.s, keys[lo].p + w.depth,
+						keys[lo].len - w.depth)) goto done;
+			continue;
+		}
+		int n = 0;
+		uint32_t i;
+		for (i = lo; i < w.hi; i++) {
+			int c = keys[i].p[w.depth] + 1;
+			if (n && codes[n - 1] == c) {
+				ends[n - 1] = i + 1;
+			} else {
+				codes[n] = c;
+				ends[n++] = i + 1;
+			}
+		}
+		int32_t b = findbase(&bd, codes, n);
+		if (b < 0) goto done;
+		dt->base[w.s] = b;
+		if (nw + n > wcap) {
+			wcap = 2 * (nw + n);
+			work *ws = realloc(stack, wcap * sizeof(work));
+			if (!ws) goto done;
+			stack = ws;
+		}
+		int j;
+		for (j = n - 1; j >= 0; j--) {	// so the lowest comes off first
+			int32_t t = b + codes[j];
+			occupy(&bd, t, w.s);
+			if ((size_t)t >= dt->nnodes) dt->nnodes = t + 1;
+			stack[nw++] = (work){ t, j ? ends[j - 1] : lo, ends[j],
+									w.depth + 1 };
+		}
+	}
+	res = HX_OK;
+done:
+	free(stack);
+	free(bd.nxt);
+	free(bd.prv);
+	free(bd.tries);
+	return res;
+} // build()
+
+static int grow(builder *bd, size_t need)
+{	/* make room for at least need slots, the new ones all free */
+	dtrie *dt = bd->dt;
+	size_t cap = bd->cap ? bd->cap : 1024;
+	while (cap < need) cap *= 2;
+	if (cap == bd->cap) return 0;
+	if (cap > INT32_MAX) return -1;
+	int32_t *base = realloc(dt->base, cap * sizeof(int32_t));
+	if (base) dt->base = base;
+	int32_t *check = realloc(dt->check, cap * sizeof(int32_t));
+	if (check) dt->check = check;
+	uint8_t *term = realloc(dt->term, (cap + 7) / 8);
+	if (term) dt->term = term;
+	int32_t *nxt = realloc(bd->nxt, cap * sizeof(int32_t));
+	if (nxt) bd->nxt = nxt;
+	int32_t *prv = realloc(bd->prv, cap * sizeof(int32_t));
+	if (prv) bd->prv = prv;
+	uint8_t *tries = realloc(bd->tries, cap);
+	if (tries) bd->tries = tries;
+	if (!base || !check || !term || !nxt || !prv || !tries) return -1;
+	size_t old = bd->cap;
+	memset(base + old, 0, (cap - old) * sizeof(int32_t));
+	memset(check + old, 0, (cap - old) * sizeof(int32_t));
+	memset(term + (old + 7) / 8, 0, (cap + 7) / 8 - (old + 7) / 8);
+	memset(tries + old, 0, cap - old);
+	size_t i;
+	for (i = old; i < cap; i++) {	// a chain, joined in at the end
+		nxt[i] = i + 1;
+		prv[i] = i - 1;
+	}
+	if (bd->head == -1) {
+		bd->head = old;
+		prv[old] = cap - 1;
+		nxt[cap - 1] = old;
+	} else {
+		int32_t last = prv[bd->head];
+		nxt[last] = old;
+		prv[old] = last;
+		nxt[cap - 1] = bd->head;
+		prv[bd->head] = cap - 1;
+	}
+	bd->cap = cap;
+	return 0;
+} // grow()
+
+static void unlink_free(builder *bd, int32_t x)
+{
+	if (bd->nxt[x] == x) {
+		bd->head = -1;
+		return;
+	}
+	bd->nxt[bd->prv[x]] = bd->nxt[x];
+	bd->prv[bd->nxt[x]] = bd->prv[x];
+	if (bd->head == x) bd->head = bd->nxt[x];
+} // unlink_free()
+
+static void occupy(builder *bd, int32_t x, int32_t parent)
+{
+	if (bd->tries[x] < MAXTRIES) unlink_free(bd, x);
+	bd->dt->check[x] = parent + 1;
+} // occupy()
+
+static int32_t findbase(builder *bd, const int *codes, int n)
+{	/* First free slot the lowest child fits that leaves room for the
+	 * rest. The slots are grown to cover every child, -1 when they can't.
+	*/
+	if (bd->head == -1 && grow(bd, bd->cap + 1)) return -1;
+	int32_t e = bd->head;
+	while (1) {
+		int64_t b = (int64_t)e - codes[0];
+		if (b >= 0) {
+			int i;
+			for (i = 1; i < n; i++) {
+				int64_t x = b + codes[i];
+				if ((size_t)x < bd->cap && bd->dt->check[x]) break;
+			}
+			if (i == n) {
+				if (grow(bd, b + codes[n - 1] + 1)) return -1;
+				return b;
+			}
+		}
+		int32_t next = bd->nxt[e];
+		int last = (next == bd->head);
+		if (++bd->tries[e] == MAXTRIES) unlink_free(bd, e);
+		if (last || bd->head == -1) {	// nothing fits, try past the end
+			size_t old = bd->cap;
+			if (grow(bd, old + 1)) return -1;
+			e = old;
+		} else {
+			e = next;
+		}
+	}
+} // findbase()
+
+static int addtail(builder *bd, int32_t s, const unsigned char *p,
+					uint32_t len)
+{	/* s has one key left below it, the rest of it goes in the pool */
+	dtrie *dt = bd->dt;
+	size_t need = dt->taillen + sizeof(len) + len;
+	if (need > INT32_MAX) return -1;
+	if (need > bd->tailcap) {
+		size_t cap = bd->tailcap ? bd->tailcap : 64 * 1024;
+		while (cap < need) cap *= 2;
+		char *t = realloc(dt->tail, cap);
+		if (!t) return -1;
+		dt->tail = t;
+		bd->tailcap = cap;
+	}
+	dt->base[s] = -(int32_t)dt->taillen - 1;
+	memcpy(dt->tail + dt->taillen, &len, sizeof(len));
+	memcpy(dt->tail + dt->taillen + sizeof(len), p, len);
+	dt->taillen = need;
+	return 0;
+} // addtail()
@@ -0,0 +1,98 @@
+/*      dict.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* The dictionary matcher behind hx_compile_dict(). The patterns are
+ * held in a double array trie whose single key branches are cut off into
+ * a tail pool, in front of which sit bitmaps of the 1 and 2 byte patterns
+ * and a hashed bitmap of 3 byte prefixes, so most input positions are
+ * turned away without touching the trie at all.
+*/
+
+#ifndef _DICT_H
+#define _DICT_H
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct dtrie {	// as built, before it goes into a program image
+	int32_t *base;	// < 0 is -(tail offset + 1), a node with one key left
+	int32_t *check;	// parent index + 1, 0 for a free slot
+	uint8_t *term;	// bitmap, a pattern ends at this node
+	size_t nnodes;
+	char *tail;	// uint32_t length then the bytes, per tail
+	size_t taillen;
+	uint8_t one[32];	// bitmap of the 1 byte patterns
+	uint8_t pair[8192];	// and of the 2 byte ones
+	uint8_t *tri;	// hashed 3 byte prefixes of the longer ones
+	uint32_t tribits;
+	size_t npat;
+	size_t maxlen;
+	size_t minlen;
+	int allzero;	// some pattern is all 0x00
+} dtrie;
+
+typedef struct dictsec {	// where the dictionary lies in a program image
+	uint64_t npat;
+	uint64_t nnodes;
+	uint64_t baseoff;
+	uint64_t checkoff;
+	uint64_t termoff;
+	uint64_t oneoff;
+	uint64_t pairoff;
+	uint64_t trioff;
+	uint64_t tailoff;
+	uint64_t taillen;
+	uint32_t tribits;
+	uint32_t pad;
+} dictsec;
+
+typedef struct dview {	// a dictsec turned back into pointers for a run
+	const int32_t *base;
+	const int32_t *check;
+	const uint8_t *term;
+	uint64_t nnodes;
+	const uint8_t *one;
+	const uint8_t *pair;
+	const uint8_t *tri;
+	uint32_t tribits;
+	const unsigned char *tail;
+	uint64_t taillen;
+} dview;
+
+int dt_build(const char *path, dtrie *dt);
+int dt_build_mem(const unsigned char *bytes, const uint32_t *lens,
+					size_t n, dtrie *dt);
+void dt_free(dtrie *dt);
+// Load a hex list file and build its trie, or build it from n patterns
+// laid end to end in bytes. Returns HX_OK or HX_E*.
+
+size_t dt_size(const dtrie *dt);
+void dt_place(const dtrie *dt, char *image, uint64_t off, dictsec *sec);
+int dt_check(const dictsec *sec, uint64_t size);
+void dt_view(const char *image, const dictsec *sec, dview *dv);
+// Copy into, validate against and read from a program image.
+
+const char *dt_next(const dview *dv, const char *from, size_t pos,
+					size_t limit, size_t len, size_t *mlen);
+// Leftmost longest match starting before limit, NULL if none.
+
+int dt_partial(const dview *dv, const char *p, size_t avail);
+// Could more bytes after p[avail - 1] make a match starting at p?
+
+#endif
@@ -37,9 +37,10 @@ fdata readfile(const char *filename, off_t extra, int fatal)
     struct stat sb;
     if (dostat(filename, &sb, fatal) == -1)	return data;
     fpi = dofopen(filename, "r");
-    data.from = docalloc(sb.st_size + extra, sizeof(char), "readfile");
+    data.from = domalloc(sb.st_size + extra, "readfile");
 	bytesread = dofread(filename, data.from, sb.st_size, fpi);
 	dofclose (fpi);
+	memset(data.from + bytesread, 0, extra);	// only the extra is zeroed
     data.to = data.from + bytesread + extra;
     return data;
 } // readfile()
@@ -149,6 +150,21 @@ void dowrite(int fd, char *writebuf)
 	}
 } // dowrite()
 
+void writeall(int fd, const void *from, size_t len)
+{	/* all of len, going round again after a short write or EINTR */
+	const char *p = from;
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) {
+			perror("write()");
+			exit(EXIT_FAILURE);
+		}
+		p += n;
+		len -= n;
+	}
+} // writeall()
+
 int getans(const char *prompt, const char *choices)
 {
 	/* Prompt the user with prompt then loop showing choices until
@@ -254,8 +270,9 @@ fdata readpseudofile(const char *path, off_t extra)
 	fdata mydata;
 	size_t fsize = count_file_bytes(path);
 	FILE *fpi = dofopen(path, "r");
-	mydata.from = docalloc(fsize + extra, 1, "readpseudofile()");
+	mydata.from = domalloc(fsize + extra, "readpseudofile()");
 	dofread(path, mydata.from, fsize, fpi);
+	memset(mydata.from + fsize, 0, extra);
 	mydata.to = mydata.from + (fsize + extra);
 	dofclose(fpi);
 	return mydata;
@@ -285,6 +302,16 @@ void *docalloc(size_t nmemb, size_t size, const char *func)
 	return from;
 } // docalloc()
 
+void *domalloc(size_t size, const char *func)
+{	/* as docalloc() without zeroing, for buffers about to be filled */
+	char *from = malloc(size ? size : 1);
+	if (!from) {
+		fprintf(stderr, "Failed to get memory in %s\n", func);
+		exit(EXIT_FAILURE);
+	}
+	return from;
+} // domalloc()
+
 size_t dofread(const char *fn, void *fro, size_t nbytes, FILE *fpi)
 {	/* fread() with error handling, fn is for error reporting only. */
 	size_t wasread = fread(fro, 1, nbytes, fpi);
@@ -506,6 +533,63 @@ int doopen(const char *fn, const char *mode)
 	return ofd;
 } // doopen()
 
+char *hexbytes(const char *hex, size_t *len, const char *what)
+{	/* a hex string, as the expression has them, to the bytes */
+	size_t n = strlen(hex);
+	if (n == 0 || n % 2) {
+		fprintf(stderr, "%s needs an even number of hex digits: %s\n",
+				what, hex);
+		exit(EXIT_FAILURE);
+	}
+	char *res = domalloc(n / 2, "hexbytes()");
+	size_t i;
+	for (i = 0; i < n; i += 2) {
+		char pair[3] = { hex[i], hex[i + 1], 0 };
+		if (!isxdigit((unsigned char)pair[0]) ||
+			!isxdigit((unsigned char)pair[1])) {
+			fprintf(stderr, "%s has invalid hex chars: %s\n", what, hex);
+			exit(EXIT_FAILURE);
+		}
+		res[i / 2] = strtoul(pair, NULL, 16);
+	}
+	*len = n / 2;
+	return res;
+} // hexbytes()
+
+void copyrange(int ifd, off_t off, int ofd, size_t len)
+{	/* len bytes of ifd from off to wherever ofd is. copy_file_range()
+	 * shares the extents where the fs can, where it can't at all, across
+	 * filesystems say, read and write them.
+	*/
+	loff_t ioff = off;
+	while (len) {
+		ssize_t res = copy_file_range(ifd, &ioff, ofd, NULL, len, 0);
+		if (res > 0) {
+			len -= res;
+			continue;
+		}
+		if (res == -1 && errno == EINTR) continue;
+		if (res == 0 || errno == EXDEV || errno == EINVAL ||
+			errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF) break;
+		perror("copy_file_range()");
+		exit(EXIT_FAILURE);
+	}
+	char buf[64 * 1024];
+	while (len) {
+		size_t n = (len < sizeof(buf)) ? len : sizeof(buf);
+		ssize_t res = pread(ifd, buf, n, ioff);
+		if (res == -1 && errno == EINTR) continue;
+		if (res <= 0) {
+			if (res == 0) errno = EIO;	// it was shorter than it said
+			perror("read()");
+			exit(EXIT_FAILURE);
+		}
+		writeall(ofd, buf, res);
+		ioff += res;
+		len -= res;
+	}
+} // copyrange()
+
 void copyfile(const char *filefro, const char *fileto)
 {	/* will abort with error message on error, no return value needed */
 	const off_t chunk = 128 * 1024 * 1024;	// 128 megs
@@ -57,14 +57,18 @@ int direxists(const char *path);
 // man (3) fileexists, man () direxists
 
 int doopen(const char *fn, const char *mode);
+void copyrange(int ifd, off_t off, int ofd, size_t len);
+char *hexbytes(const char *hex, size_t *len, const char *what);
 void doclose(int fd);
 int is_in_list(const char *what, const char **list);
 void doread(int fd, size_t bcount, char *result);
 void dowrite(int fd, char *writebuf);
+void writeall(int fd, const void *from, size_t len);
 int dostat(const char *fn, struct stat *sb, int fatal);
 void do_mkdir(const char *head_dir, const char *newdir);
 fdata dorealloc(fdata indata, int change);
 void *docalloc(size_t nmemb, size_t size, const char *func);
+void *domalloc(size_t size, const char *func);
 char *getconfigpath(const char *pname);
 fdata readtextfile(const char *filename, off_t extra, int fatal);
 fdata readfile(const char *filename, off_t extra, int fatal);
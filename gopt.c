@@ -23,6 +23,10 @@
 #include "stringops.h"
 #include "gopt.h"
 
+char *optstring;
+char *helptext;
+char *synopsis;
+
 
 options_t process_options(int argc, char **argv)
 {
@@ -33,7 +37,27 @@ options_t process_options(int argc, char **argv)
   "\tWhere both find and replace must be strings of hex digits\n"
   "\texpressed in ASCII. The edited result is sent to stdout.\n"
   "\tThe optional count if specified will cause editing to quit once\n"
-  "\tthe number of edits performed reaches the specified count.\n\n"
+  "\tthe number of edits performed reaches the specified count.\n"
+  "\t=-count edits the last count matches only, =@count just the\n"
+  "\tcount'th match and =@-count the count'th from the end.\n"
+  "\tIn find ?? matches any byte and ( ) makes a group, which \\1 to\n"
+  "\t\\9 in replace put back, \\0 the whole match, eg\n"
+  "\t/FFD8(?\?\?\?)(?\?\?\?)/FFD8\\2\\1/s\n"
+  "\tfind may start with a lookbehind, (?<=hex) or (?<!hex), and end\n"
+  "\twith a lookahead, (?=hex) or (?!hex), that must or must not be\n"
+  "\tbefore or after a match, eg /(?<!0D)0A/0D0A/s\n"
+  "\tU+XXXX or U+{X..XXXXXX} may stand for a code point's UTF-8.\n"
+  "\tfind starting (?i) matches ASCII letters in either case.\n\n"
+  "\thexsed [-n] [=count]//n filename\n"
+  "\tNormalize UTF-8 text: LS, PS and NEL become a space, or go at the\n"
+  "\tend of a line, NBSP a space, and ZWSP and BOM are removed.\n\n"
+  "\thexsed --compile-to prog.hxp [=count]/find/[replace/]op\n\n"
+  "\thexsed [-n] --program prog.hxp filename\n\n"
+  "\thexsed [-n] --dict list.hex [=count]//[replace/]op filename\n\n"
+  "\thexsed [-n] --text string [--encodings list] [=count]//[replace/]op"
+  " filename\n\n"
+  "\thexsed [-n] --carve start/end [--template name] filename\n\n"
+  "\thexsed [-n] [=count]/find/b|e [--template name] filename\n\n"
   "\thexsed -[a|e|i|o] char|esc sequence. Delivers the 2 digit hex\n"
   "\tASCII string that represents the input char.\n\n"
   "\thexsed -s string Delivers the 2 didgit hex ASCII string for each\n"
@@ -64,7 +88,75 @@ options_t process_options(int argc, char **argv)
   "\tNull terminated array of bytes. Outputs the 2 digit hex "
   "representation\n\t of each byte in the string.\n\n"
   "\t-n, --edit-count\n"
-  "\tCauses the count of applied edits to be output.\n"
+  "\tCauses the count of applied edits to be output.\n\n"
+  "\t--no-uring\n"
+  "\tUse plain read() and write() even where io_uring is available.\n\n"
+  "\t--direct\n"
+  "\tRead the input with O_DIRECT and drop the output from the page\n"
+  "\tcache as it is written, leaving the cache to other programs.\n\n"
+  "\t--serve socketpath\n"
+  "\tRun as a server on the Unix socket socketpath, editing on behalf\n"
+  "\tof clients and keeping their compiled expressions for reuse.\n\n"
+  "\t--compile-to prog.hxp\n"
+  "\tCompile the expression into the file prog.hxp and quit.\n\n"
+  "\t--program prog.hxp\n"
+  "\tRun the compiled program in prog.hxp instead of an expression.\n\n"
+  "\t--dict list.hex\n"
+  "\tFind every pattern in list.hex, one hex string per line, leaving\n"
+  "\tthe find string of the expression empty.\n\n"
+  "\t--text string\n"
+  "\tFind string in UTF-8, UTF-16LE and UTF-16BE at once, the find\n"
+  "\tstring left empty as for --dict. Each hit's offset and encoding\n"
+  "\tgo to stderr.\n\n"
+  "\t--encodings list\n"
+  "\tThe encodings for --text, a comma list of utf8, utf16le and\n"
+  "\tutf16be, any with :i after it to ignore ASCII case, eg\n"
+  "\tutf8:i,utf16le:i\n\n"
+  "\t--compress gzip|zstd\n"
+  "\tCompress the output. gzip or zstd compressed input is always\n"
+  "\trecognised and expanded, and filename may be - for stdin.\n\n"
+  "\t--follow\n"
+  "\tAt the end of the file wait for it to grow and edit what is\n"
+  "\tappended as it arrives, until interrupted.\n\n"
+  "\t--update outfile\n"
+  "\tWrite to outfile, keeping a manifest in outfile.hxm so that the next\n"
+  "\trun over a mostly unchanged file only edits the blocks that changed.\n\n"
+  "\t--emit-patch patchfile\n"
+  "\tWrite the edits as a patch to patchfile instead of the edited file.\n\n"
+  "\t--apply-patch patchfile\n"
+  "\tApply patchfile to filename, no expression is given.\n\n"
+  "\t--checksum[=sumfile]\n"
+  "\tReport CRC32C sums of the input and the output, on stderr or in\n"
+  "\tsumfile.\n\n"
+  "\t--progress[=secs]\n"
+  "\tEvery secs seconds, default 5, report progress on stderr. SIGUSR1\n"
+  "\tasks for a report at any time. Plain edits only, not --records,\n"
+  "\t--update, --emit-patch, --apply-patch, --carve or a split.\n\n"
+  "\t--stats statsfile\n"
+  "\tKeep the progress counters in statsfile, rewritten every second.\n\n"
+  "\t--journal jfile\n"
+  "\tCheckpoint the edit to jfile every 10 seconds.\n\n"
+  "\t--resume\n"
+  "\tCarry on an interrupted edit from the last checkpoint in jfile.\n\n"
+  "\t--in-place\n"
+  "\tWith --journal, write same length substitutions into the file\n"
+  "\titself.\n\n"
+  "\t--records hex\n"
+  "\tEdit each record, ended by the delimiter hex, as an input of its\n"
+  "\town, the count applying to each, with records edited in parallel.\n\n"
+  "\t--record-length n\n"
+  "\tThe same with records of n bytes each.\n\n"
+  "\t--range N-M\n"
+  "\tEdit only records N to M, counting from 1. N- is N to the end.\n\n"
+  "\t--containing hex\n"
+  "\tEdit only records containing hex.\n\n"
+  "\t--carve start/end\n"
+  "\tWrite every region from a start marker to the next end marker,\n"
+  "\tboth hex strings, to files of its own. No expression is given.\n\n"
+  "\t--template name\n"
+  "\tName the files written by --carve, or split into by the ops b\n"
+  "\tand e, cutting before or after each match, with one %d for\n"
+  "\ttheir number.\n"
   ;
 
 	optstring = ":ha:e:i:o:s:n";
@@ -77,8 +169,35 @@ options_t process_options(int argc, char **argv)
 	opts.line = (char *)NULL;
 	opts.quiet = 1;
 	opts.esc = (char *)NULL;
+	opts.uring = 1;
+	opts.direct = 0;
+	opts.serve = (char *)NULL;
+	opts.compileto = (char *)NULL;
+	opts.program = (char *)NULL;
+	opts.dict = (char *)NULL;
+	opts.compress = (char *)NULL;
+	opts.follow = 0;
+	opts.update = (char *)NULL;
+	opts.emitpatch = (char *)NULL;
+	opts.applypatch = (char *)NULL;
+	opts.checksum = 0;
+	opts.sumfile = (char *)NULL;
+	opts.progress = 0;
+	opts.stats = (char *)NULL;
+	opts.journal = (char *)NULL;
+	opts.resume = 0;
+	opts.inplace = 0;
+	opts.records = (char *)NULL;
+	opts.reclen = 0;
+	opts.range = (char *)NULL;
+	opts.containing = (char *)NULL;
+	opts.carve = (char *)NULL;
+	opts.tmpl = (char *)NULL;
+	opts.text = (char *)NULL;
+	opts.encodings = (char *)NULL;
 
 	int c;
+	char *end;	// of a number in optarg
 
 	while(1) {
 		int this_option_optind = optind ? optind : 1;
@@ -91,6 +210,31 @@ options_t process_options(int argc, char **argv)
 		{"octal",		1,	0,	'o' },
 		{"string",		1,	0,	's' },
 		{"edit-count",	0,	0,	'n' },
+		{"no-uring",	0,	0,	0 },
+		{"direct",		0,	0,	0 },
+		{"serve",		1,	0,	0 },
+		{"compile-to",	1,	0,	0 },
+		{"program",		1,	0,	0 },
+		{"dict",		1,	0,	0 },
+		{"compress",	1,	0,	0 },
+		{"follow",		0,	0,	0 },
+		{"update",		1,	0,	0 },
+		{"emit-patch",	1,	0,	0 },
+		{"apply-patch",	1,	0,	0 },
+		{"checksum",	2,	0,	0 },
+		{"progress",	2,	0,	0 },
+		{"stats",		1,	0,	0 },
+		{"journal",		1,	0,	0 },
+		{"resume",		0,	0,	0 },
+		{"in-place",	0,	0,	0 },
+		{"records",		1,	0,	0 },
+		{"record-length",	1,	0,	0 },
+		{"range",		1,	0,	0 },
+		{"containing",	1,	0,	0 },
+		{"carve",		1,	0,	0 },
+		{"template",	1,	0,	0 },
+		{"text",		1,	0,	0 },
+		{"encodings",	1,	0,	0 },
 		{0,	0,	0,	0 }
 			};
 
@@ -104,6 +248,92 @@ options_t process_options(int argc, char **argv)
 		switch (c) {
 		case 0:
 			switch (option_index) {
+			case 7:	// no-uring
+				opts.uring = 0;
+			break;
+			case 8:	// direct
+				opts.direct = 1;
+			break;
+			case 9:	// serve
+				opts.serve = dostrdup(optarg);
+			break;
+			case 10:	// compile-to
+				opts.compileto = dostrdup(optarg);
+			break;
+			case 11:	// program
+				opts.program = dostrdup(optarg);
+			break;
+			case 12:	// dict
+				opts.dict = dostrdup(optarg);
+			break;
+			case 13:	// compress
+				opts.compress = dostrdup(optarg);
+			break;
+			case 14:	// follow
+				opts.follow = 1;
+			break;
+			case 15:	// update
+				opts.update = dostrdup(optarg);
+			break;
+			case 16:	// emit-patch
+				opts.emitpatch = dostrdup(optarg);
+			break;
+			case 17:	// apply-patch
+				opts.applypatch = dostrdup(optarg);
+			break;
+			case 18:	// checksum
+				opts.checksum = 1;
+				if (optarg) opts.sumfile = dostrdup(optarg);
+			break;
+			case 19:	// progress
+				opts.progress = optarg ? atoi(optarg) : 5;
+				if (opts.progress < 1) {
+					fprintf(stderr, "Bad progress interval: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+			break;
+			case 20:	// stats
+				opts.stats = dostrdup(optarg);
+			break;
+			case 21:	// journal
+				opts.journal = dostrdup(optarg);
+			break;
+			case 22:	// resume
+				opts.resume = 1;
+			break;
+			case 23:	// in-place
+				opts.inplace = 1;
+			break;
+			case 24:	// records
+				opts.records = dostrdup(optarg);
+			break;
+			case 25:	// record-length
+				errno = 0;
+				opts.reclen = strtoul(optarg, &end, 10);
+				if (!isdigit(optarg[0]) || *end || errno ||
+					opts.reclen < 1) {
+					fprintf(stderr, "Bad record length: %s\n", optarg);
+					exit(EXIT_FAILURE);
+				}
+			break;
+			case 26:	// range
+				opts.range = dostrdup(optarg);
+			break;
+			case 27:	// containing
+				opts.containing = dostrdup(optarg);
+			break;
+			case 28:	// carve
+				opts.carve = dostrdup(optarg);
+			break;
+			case 29:	// template
+				opts.tmpl = dostrdup(optarg);
+			break;
+			case 30:	// text
+				opts.text = dostrdup(optarg);
+			break;
+			case 31:	// encodings
+				opts.encodings = dostrdup(optarg);
+			break;
 			} // switch()
 		break;
 		case 'h':
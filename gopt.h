@@ -21,15 +21,41 @@
 
 #ifndef GOPT_H
 #define GOPT_H
-char *optstring;
-char *helptext;
-char* synopsis;
+extern char *optstring;
+extern char *helptext;
+extern char *synopsis;
 
 typedef struct options_t {
 int ci;
 int quiet;
 char *line;
 char *esc;
+int uring;
+int direct;
+char *serve;
+char *compileto;
+char *program;
+char *dict;
+char *compress;
+int follow;
+char *update;
+char *emitpatch;
+char *applypatch;
+int checksum;
+char *sumfile;
+int progress;
+char *stats;
+char *journal;
+int resume;
+int inplace;
+char *records;
+size_t reclen;
+char *range;
+char *containing;
+char *carve;
+char *tmpl;
+char *text;
+char *encodings;
 } options_t;
 
 void dohelp(int forced);
@@ -25,31 +25,53 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <signal.h>
 #include "fileops.h"
 #include "gopt.h"
+#include "pipeline.h"
+#include "libhexsed.h"
+#include "serve.h"
+#include "zio.h"
+#include "incr.h"
+#include "patch.h"
+#include "crc.h"
+#include "progress.h"
+#include "journal.h"
+#include "records.h"
+#include "carve.h"
 
-typedef struct sedex {
-	int op;
-	int flen;
-	int rlen;
-	int edcount;
-	char *tofind;
-	char *toreplace;
-} sedex;
+typedef struct sinkctx {
+	pipeline *pl;
+	int sum;	// keep a CRC32C of the output as it goes
+	uint32_t crc;
+	uint64_t len;	// output so far
+} sinkctx;
+
+typedef struct hitctx {	// for listing --text hits
+	const hx_program *prog;
+	journal *jn;	// told of them too, if --in-place
+} hitctx;
 
 static char *eslookup(const char *tofind);
-static sedex validate_expr(const char *expr);
 static char *str2hex(const char *str);
-static int validatehexstr(const char *hexstr);
-static char *hex2asc(const char *hexstr);
-static int hexchar2int(const char *hexpair);
-static void editfile(const char *fn, sedex mysx, int quiet);
+static void editfile(const char *fn, hx_program *prog, options_t opts);
+static int plsink(void *ctx, const char *from, size_t len);
+static int onhit(void *ctx, off_t at, const char *found, size_t mlen);
+static void putsums(const options_t *opts, const char *fn,
+					const uint32_t *crc, const uint64_t *len);
+static int ispipe(const char *fn);
+static void canjournal(const hx_program *prog, options_t opts, int ifd);
+static void plainonly(const options_t *opts);
+static void lookback(hx_stream *st, const hx_program *prog, int ifd,
+						off_t at);
+static off_t fromtail(const hx_program *prog, options_t opts, int ifd,
+						long *skip);
 
 int main(int argc, char **argv)
 {
 	options_t opts = process_options(argc, argv);
 	// 3 opts vars are processed here, the other is dealt with in gopt.
-	int quiet = opts.quiet;
 	if (opts.line) {
 		char *cp = str2hex(opts.line);
 		fprintf(stdout, "%s\n", cp);
@@ -63,32 +85,155 @@ int main(int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
+	if (opts.serve) serve(opts.serve);	// does not return
+
+	if (opts.applypatch) {	// the patch stands in for the expression
+		if (!argv[optind]) {
+			fprintf(stderr, "No file name provided\n");
+			dohelp(1);
+		}
+		plainonly(&opts);
+		applypatch(opts.applypatch, argv[optind], opts.quiet);
+		exit(EXIT_SUCCESS);
+	}
+
+	if (opts.carve) {	// and the markers stand in for it
+		if (!argv[optind]) {
+			fprintf(stderr, "No file name provided\n");
+			dohelp(1);
+		}
+		plainonly(&opts);
+		carve(argv[optind], opts.carve,
+				opts.tmpl ? opts.tmpl : "carve%06d", opts.quiet);
+		exit(EXIT_SUCCESS);
+	}
+
 	// now process the non-option arguments
 
-	// 1.Check that argv[optind] exists.
-	if (!(argv[optind])) {
-		fprintf(stderr, "No expression provided\n");
-		dohelp(1);
+	hx_program *prog;
+	int res;
+	if (opts.program && (opts.dict || opts.text || opts.encodings)) {
+		fputs("--program is already compiled, no --dict, --text or"
+				" --encodings\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (opts.program) {
+		// a program compiled earlier stands in for the expression
+		res = hx_load(opts.program, &prog);
+		if (res != HX_OK) {
+			if (res == HX_EIO) perror(opts.program);
+			else fprintf(stderr, "%s:\n%s\n", hx_strerror(res), opts.program);
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		// 1.Check that argv[optind] exists.
+		if (!(argv[optind])) {
+			fprintf(stderr, "No expression provided\n");
+			dohelp(1);
+		}
+
+		// 2. Check that it's meaningful, a valid expression.
+		if (opts.dict && opts.text) {
+			fputs("Only one of --dict and --text\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		if (opts.encodings && !opts.text) {
+			fputs("--encodings is only for --text\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		if (opts.dict) {
+			res = hx_compile_dict(argv[optind], opts.dict, &prog);
+		} else if (opts.text) {
+			res = hx_compile_text(argv[optind], opts.text, opts.encodings,
+									&prog);
+		} else {
+			res = hx_compile(argv[optind], &prog);
+		}
+		if (res == HX_EIO) {
+			perror(opts.dict);
+			exit(EXIT_FAILURE);
+		}
+		if (res != HX_OK) {
+			fprintf(stderr, "%s:\n%s", hx_strerror(res), argv[optind]);
+			if (opts.dict) fprintf(stderr, " with %s", opts.dict);
+			if (opts.text) fprintf(stderr, " with %s in %s", opts.text,
+							opts.encodings ? opts.encodings : "all encodings");
+			fputc('\n', stderr);
+			exit(EXIT_FAILURE);
+		}
+		optind++;
 	}
 
-	// 2. Check that it's meaningful, a valid expression.
-	sedex mysx = validate_expr(argv[optind]);	// no return if error
+	if (opts.compileto) {
+		if (hx_save(prog, opts.compileto) != HX_OK) {
+			perror(opts.compileto);
+			exit(EXIT_FAILURE);
+		}
+		hx_free(prog);
+		exit(EXIT_SUCCESS);
+	}
 
-	optind++;
 	// 3.Check that argv[optind] exists.
 	if (!(argv[optind])) {
 		fprintf(stderr, "No file name provided\n");
 		dohelp(1);
 	}
 
-	// 4. Check that it's meaningful, ie file exists.
-	if (fileexists(argv[optind]) == -1) {
+	// 4. Check that it's meaningful, ie file exists, or - for stdin.
+	if (strcmp(argv[optind], "-") != 0 && fileexists(argv[optind]) == -1
+		&& !ispipe(argv[optind])) {
 		fprintf(stderr, "No such file: %s\n", argv[optind]);
 		dohelp(1);
 	}
+	if ((opts.resume || opts.inplace) && !opts.journal) {
+		fprintf(stderr, "--resume and --in-place need --journal\n");
+		dohelp(1);
+	}
+	if ((opts.range || opts.containing) && !opts.records && !opts.reclen) {
+		fprintf(stderr, "--range and --containing need --records or"
+				" --record-length\n");
+		dohelp(1);
+	}
 	// now do the edits
 	char *edfile = argv[optind];
-	editfile(edfile, mysx, quiet);
+	if (hx_op(prog) == 'b' || hx_op(prog) == 'e' || opts.records ||
+		opts.reclen || opts.emitpatch || opts.update) plainonly(&opts);
+	if (hx_op(prog) == 'b' || hx_op(prog) == 'e') {	// a split
+		if (opts.records || opts.reclen || opts.update || opts.emitpatch ||
+			opts.journal || opts.follow || opts.compress) {
+			fputs("The split ops write files of their own, without"
+					" --records, --update, --emit-patch, --journal, --follow"
+					" or --compress\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		split(edfile, prog, opts.tmpl ? opts.tmpl : "split%06d",
+				opts.quiet);
+	} else if (opts.records || opts.reclen) {
+		if (opts.follow || opts.journal || opts.update || opts.emitpatch ||
+			opts.compress || opts.checksum) {
+			fputs("--records and --record-length don't go with --follow,"
+					" --journal, --update, --emit-patch, --compress or"
+					" --checksum\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		editrecords(edfile, prog, opts.records, opts.reclen, opts.range,
+					opts.containing, opts.quiet);
+	} else if (opts.emitpatch) {
+		if (hx_op(prog) == 'n') {	// what it puts in depends on what follows
+			fputs("--emit-patch can't record op n\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		emitpatch(edfile, prog, opts.emitpatch, opts.quiet);
+	} else if (opts.update) {
+		if (fileexists(edfile) != 0) {	// it must be there to map and hash
+			fprintf(stderr, "--update needs a regular file: %s\n", edfile);
+			exit(EXIT_FAILURE);
+		}
+		update(edfile, prog, opts.update, opts.quiet);
+	} else {
+		editfile(edfile, prog, opts);
+	}
+	hx_free(prog);
 	return 0;
 }//main()
 
@@ -112,137 +257,6 @@ char *eslookup(const char *tofind)
 	return result;
 } //
 
-sedex validate_expr(const char *expr)
-{
-	/*
-	 * Fill in the sedex struct with proper values from expr or abort
-	 * if anything in expr is malformed.
-	*/
-	char *buf;
-	char *cp;
-	buf = strdup(expr);
-	sedex mysx = {0};
-	/* Adding the ability to specify a count of patterns to be edited.*/
-	if (buf[0] == '=') {
-		mysx.edcount = strtol(&buf[1], NULL, 10);
-		cp = &buf[1];
-		while (isdigit(*cp)) cp++;
-		char *tmp = strdup(cp);
-		strcpy(buf, tmp);
-		free(tmp);
-	} else {
-		mysx.edcount = INT_MAX;
-	}
-	size_t len = strlen(buf);
-	// test that expr has properly formed separators and command.
-	int badform = 0;
-	int count = 0;
-	int i;
-	for (i = 0; i < (int)len; i++) {
-		if (buf[i] == '/') {
-			count++;
-		}
-	}
-	if (buf[0] != '/' || buf[len - 2] != '/') {
-		badform = 1;
-	}
-	if (!(count == 2 || count == 3)) {
-		badform = 1;
-	}
-	char op = buf[len-1];
-	cp = strchr("dsai", op);
-	if (!cp) badform = 1;
-	if (op == 'd') {
-		if (count != 2) badform = 1;
-	} else {
-		if (count != 3) badform = 1;
-	}
-	if (badform) {
-		fprintf(stderr, "Badly formed expression:\n%s\n", expr);
-		exit(EXIT_FAILURE);
-	}
-
-	// format the hex lists
-	mysx.op = op;
-	mysx.flen = mysx.rlen = 0;
-	// calculate lengths
-	cp = buf;
-	cp++;	// get past initial '/'
-	while ((*cp != '/')) {
-		mysx.flen++;
-		cp++;
-	}
-
-	if (mysx.op == 's') {
-		cp++;	//  get past initial '/'
-		while ((*cp != '/')) {
-			mysx.rlen++;
-			cp++;
-		}
-	}
-	// check that we don't have 0 length strings
-	if (mysx.flen == 0) {
-		fprintf(stderr, "Zero length search string input %s\n", expr);
-		exit(EXIT_FAILURE);
-	}
-	if (mysx.op == 's') {
-		if (mysx.rlen == 0) {
-		fprintf(stderr, "Zero length replacement string input %s\n"
-					, expr);
-		exit(EXIT_FAILURE);
-		}
-	}
-	// check that user has not obviously fubarred the hex input
-	if (mysx.flen %2 != 0 || mysx.rlen %2 != 0) {
-		fprintf(stderr, "Each hex value must be input as a pair,"
-		" eg 00..0F etc\n, %s\n", expr);
-		exit(EXIT_FAILURE);
-	}
-
-	// set the find and replace strings and check for non-hex chars.
-	char *tofind, *toreplace;
-	cp = buf;
-	cp++;	// past initial '/'
-	char *ep = strchr(cp, '/');	// content of buf is valid.
-	*ep = 0;
-	tofind = strdup(cp);
-	if (mysx.op != 'd') {
-		cp = ep + 1;
-		ep = strchr(cp, '/');
-		*ep = 0;
-		toreplace = strdup(cp);
-	}
-	free(buf);
-	if (validatehexstr(tofind) == -1) {
-		fprintf(stderr, "invalid hex chars tofind: \n %s", tofind);
-		free(tofind);
-		exit(EXIT_FAILURE);
-	} else {
-		char *res = hex2asc(tofind);
-		mysx.tofind = strdup(res);
-		free(res);
-		free(tofind);
-	}
-
-	if (mysx.op != 'd') {
-		if (validatehexstr(toreplace) == -1) {
-			fprintf(stderr, "invalid hex chars toreplace: \n %s",
-					toreplace);
-			free(toreplace);
-			exit(EXIT_FAILURE);
-		} else {
-			char *res = hex2asc(toreplace);
-			mysx.toreplace = strdup(res);
-			free(res);
-			free(toreplace);
-		}
-	}
-	// mysx.[f|r]len is double what it now is, re-assign them.
-	mysx.flen = strlen(mysx.tofind);
-	if (mysx.toreplace) mysx.rlen = strlen(mysx.toreplace);
-	return mysx;
-} // validate_expr()
-
 char *str2hex(const char *str)
 {	/* For each byte in str, return the 2 byte hex code.
 	 * Handle embedded escape sequences.
@@ -269,99 +283,252 @@ char *str2hex(const char *str)
 	return buf;
 }
 
-int validatehexstr(const char *hexstr)
-{
-	char *validhex = "0123456789abcdefABCDEF";
-	size_t len = strlen(hexstr);
-	size_t i;
-	for (i = 0; i < len; i++) {
-		char *cp = strchr(validhex, hexstr[i]);
-		if (!cp) return -1;
+void editfile(const char *fn, hx_program *prog, options_t opts)
+{	/* Streams fn through the reader/matcher/writer pipeline, with
+	 * libhexsed doing the matching on this thread.
+	*/
+	int ifd = (strcmp(fn, "-") == 0) ? 0 :
+				doopen(fn, opts.inplace ? "r+" : "r");
+	int plflags = opts.uring ? PL_URING : 0;
+	if (opts.direct) plflags |= PL_DIRECT;
+	if (opts.follow) plflags |= PL_FOLLOW;
+	if (opts.compress) {
+		int fmt = zio_byname(opts.compress);
+		if (fmt == -1) {
+			fprintf(stderr, "Unknown compression: %s\n", opts.compress);
+			exit(EXIT_FAILURE);
+		}
+		if (!zio_have(fmt)) {
+			fprintf(stderr, "This hexsed was built without %s support\n",
+					zio_name(fmt));
+			exit(EXIT_FAILURE);
+		}
+		plflags |= (fmt == ZIO_GZIP) ? PL_GZIP : PL_ZSTD;
+	}
+	struct stat sb;
+	uint64_t total = 0;	// known for plain files that aren't growing
+	if (!opts.follow && fstat(ifd, &sb) == 0 && S_ISREG(sb.st_mode))
+		total = sb.st_size;
+	journal *jn = NULL;
+	if (opts.journal) {	// and it positions ifd and stdout
+		canjournal(prog, opts, ifd);
+		plflags |= PL_RAW;	// a resume can't sniff from the middle
+		jn = jn_open(opts.journal, opts.resume, prog, ifd,
+						opts.inplace ? -1 : 1);
+	}
+	off_t tail = 0;
+	long skip = 0;
+	if (hx_fromend(prog)) {	// and the input before tail is already out
+		tail = fromtail(prog, opts, ifd, &skip);
+		plflags |= PL_RAW;
+	}
+	progress *pg = pg_start(total, opts.progress, opts.stats);	// first
+	pipeline *pl = pl_open(ifd, opts.inplace ? -1 : 1, 0, plflags);
+	if (total && pl->zin != ZIO_PLAIN) pg->total = 0;	// expanded size
+	sinkctx sc = { opts.inplace ? NULL : pl, opts.checksum, 0, 0 };
+	uint32_t icrc = 0;
+	uint64_t ilen = 0;
+	hx_stream *st;
+	int res = hx_fromend(prog) ? hx_stream_tail(prog, skip, plsink, &sc, &st)
+					: hx_stream_new(prog, plsink, &sc, &st);
+	if (res != HX_OK) {
+		fputs("Failed to get memory in editfile()\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	ilen = sc.len = tail;
+	hitctx hc = { prog, opts.inplace ? jn : NULL };
+	if (jn) {
+		hx_stream_resume(st, jn->rec.ioff, jn->rec.fcount);
+		ilen = jn->rec.ioff;
+		sc.len = jn->rec.ooff;
+		if (opts.inplace) hx_stream_matches(st, jn_match, jn);
+	}
+	if (hx_istext(prog)) hx_stream_matches(st, onhit, &hc);
+	if (ilen) lookback(st, prog, ifd, ilen);
+	iobuf *ib;
+	while ((ib = pl_next_input(pl))) {
+		if (opts.checksum) {	// while it's still in cache
+			icrc = ib->hole ? crc32c_zeros(icrc, ib->hole)
+							: crc32c(icrc, ib->data, ib->len);
+		}
+		ilen += ib->hole ? (uint64_t)ib->hole : ib->len;
+		if (ib->hole) {
+			hx_feed_zeros(st, ib->hole);
+		} else {
+			hx_feed(st, ib->data, ib->len);
+		}
+		pl_release_input(pl, ib);
+		if (opts.follow) pl_flush(pl);	// don't sit on what's come in
+		pg_update(pg, ilen, hx_count(st), sc.len);
+		if (jn && jn_due(jn)) {
+			if (!opts.inplace) pl_sync(pl);
+			jn_checkpoint(jn, hx_offset(st), sc.len, hx_count(st));
+		}
+	}
+	hx_flush(st);	// plsink() can't fail, nor can these
+	pg_update(pg, ilen, hx_count(st), sc.len);
+	pl_close(pl);
+	if (jn) jn_close(jn, hx_offset(st), sc.len, hx_count(st));
+	pg_stop(pg);
+	if (ifd) doclose(ifd);
+	if (opts.checksum) {
+		uint32_t crc[2] = { icrc, sc.crc };
+		uint64_t len[2] = { ilen, sc.len };
+		putsums(&opts, fn, crc, len);
+	}
+	if (!opts.quiet) {
+		char *what = (hx_op(prog) == 'd') ? "deletions" : "substitutions";
+		fprintf(stdout, "Did %li %s.\n", hx_count(st), what);
+	}
+	hx_stream_free(st);
+} // editfile()
+
+int plsink(void *ctx, const char *from, size_t len)
+{	/* hands the edited output to the writer thread */
+	sinkctx *sc = ctx;
+	if (sc->sum) {
+		sc->crc = from ? crc32c(sc->crc, from, len)
+						: crc32c_zeros(sc->crc, len);
+	}
+	sc->len += len;
+	if (!sc->pl) {	// in place, the edits are written by the journal
+		return 0;
+	} else if (from) {
+		pl_emit(sc->pl, from, len);
+	} else {
+		pl_emit_hole(sc->pl, len);
 	}
 	return 0;
-}
+} // plsink()
+
+int onhit(void *ctx, off_t at, const char *found, size_t mlen)
+{	/* where a --text hit is and in which encoding */
+	hitctx *hc = ctx;
+	fprintf(stderr, "%lld %s\n", (long long)at,
+			hx_encoding(hc->prog, found, mlen));
+	return hc->jn ? jn_match(hc->jn, at, found, mlen) : 0;
+} // onhit()
 
-char *hex2asc(const char *hexstr)
-{	/* take a string of hex ascii represented digits and return the
-	 * normal ascii representation.
+void putsums(const options_t *opts, const char *fn,
+				const uint32_t *crc, const uint64_t *len)
+{	/* Input then output, as CRC32C, length and name. For compressed
+	 * input or output these are of the data as edited, expanded.
 	*/
-	size_t len = strlen(hexstr);
-	char *res = calloc(len / 2 + 1, 1);	// 1 byte result for each 2 in.
-	char wrk[3] = {0};
-	size_t i, idx;
-	for (i=0, idx=0; i < len; idx++, i += 2) {
-		strncpy(wrk, &hexstr[i], 2);
-		char c = hexchar2int(wrk);
-		res[idx] = c;
-	}
-	return res;
-}
+	FILE *fp = opts->sumfile ? dofopen(opts->sumfile, "w") : stderr;
+	fprintf(fp, "crc32c %08x %llu %s\n", crc[0], (unsigned long long)len[0],
+			fn);
+	fprintf(fp, "crc32c %08x %llu -\n", crc[1], (unsigned long long)len[1]);
+	if (opts->sumfile) dofclose(fp);
+} // putsums()
 
-int hexchar2int(const char *hexpair)
-{
-	char wrk[3] = {0};
-	int c;
-	char *list = "0123456789ABCDEF";
-	int i;
-	for (i = 0; i < 2; i++) {
-		wrk[i] = toupper(hexpair[i]);
-		char *test = strchr(list, wrk[i]);
-		if (!test) {
-			fputs("\n", stdout);
-			fflush(stdout);
-			fprintf(stderr, "Not legal hex: %s\n", wrk);
+void canjournal(const hx_program *prog, options_t opts, int ifd)
+{	/* A journaled edit must be able to seek both its input and output,
+	 * and in place every edit must be the same length.
+	*/
+	struct stat sb;
+	if (ifd == 0 || opts.follow || opts.compress || opts.checksum) {
+		fputs("--journal needs a file to edit, and not --follow,"
+				" --compress or --checksum\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (hx_skip(prog) || hx_fromend(prog)) {
+		fputs("--journal can't resume =@N or a count from the end\n",
+				stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (opts.inplace) {
+		size_t rlen;
+		size_t behind, ahead;
+		const char *rep = hx_replacement(prog, &rlen);
+		hx_context(prog, &behind, &ahead);
+		if (hx_op(prog) != 's' || hx_maxlen(prog) != rlen ||
+			hx_minlen(prog) != rlen || !rep || behind) {
+			fputs("--in-place needs a substitution of the same length as"
+					" every match, with no \\N or lookbehind\n", stderr);
 			exit(EXIT_FAILURE);
 		}
+	} else if (fstat(1, &sb) == -1 || !S_ISREG(sb.st_mode) ||
+				(fcntl(1, F_GETFL) & O_APPEND)) {
+		fputs("--journal needs stdout to be a file, opened with 1<>\n",
+				stderr);
+		exit(EXIT_FAILURE);
 	}
-	c = strtol(wrk, NULL, 16);
-	return c;
-} // hexchar2int()
+} // canjournal()
 
-void editfile(const char *fn, sedex mysx, int quiet)
-{
-	int fcount = 0;
-	fdata mydat = readfile(fn, 0, 0);
-	char *cp = mydat.from;
-	while (cp < mydat.to) {
-		char *found = memmem(cp, mydat.to - cp, mysx.tofind, mysx.flen);
-		int doit;
-		// number of edits may be limited by count.
-		doit = (found && (fcount < mysx.edcount));
-		if (!doit) {
-			// write out the rest of the file.
-			fwrite(cp, 1, mydat.to - cp, stdout);
-			cp = mydat.to;
-		} else {
-			fcount++;
-			// write the file content up to the find string
-			fwrite(cp, 1, found - cp, stdout);
-			switch (mysx.op)
-			{
-				case 'a':	// append to find string
-					fwrite(mysx.tofind, 1, mysx.rlen, stdout);
-					fwrite(mysx.toreplace, 1, mysx.rlen, stdout);
-					break;
-				case 'i':	// insert before find string
-					fwrite(mysx.toreplace, 1, mysx.rlen, stdout);
-					fwrite(mysx.tofind, 1, mysx.rlen, stdout);
-					break;
-				case 'd':	// delete find string
-					// do nothing
-					break;
-				case 's':	// substitute find string.
-					fwrite(mysx.toreplace, 1, mysx.rlen, stdout);
-					break;
-			} // switch()
-			cp = found + mysx.flen;
-		}
-	} // while()
-	if (!quiet) {
-		char *what = (mysx.op == 'd') ? "deletions" : "substitutions";
-		fprintf(stdout, "Did %i %s.\n", fcount, what);
+void plainonly(const options_t *opts)
+{	/* Only a plain edit runs the progress thread. Anything else refuses
+	 * --progress and --stats, and ignores SIGUSR1 rather than dying of it.
+	*/
+	if (opts->progress || opts->stats) {
+		fputs("--progress and --stats only go with a plain edit, not"
+				" --records, --update, --emit-patch, --apply-patch, --carve"
+				" or a split\n", stderr);
+		exit(EXIT_FAILURE);
 	}
+	signal(SIGUSR1, SIG_IGN);
+} // plainonly()
 
-	free(mydat.from);
-	if (mysx.toreplace) free(mysx.toreplace);
-	free(mysx.tofind);
+void lookback(hx_stream *st, const hx_program *prog, int ifd, off_t at)
+{	/* Starting at at rather than the start of the input, a lookbehind
+	 * must still see what comes before it.
+	*/
+	size_t behind, ahead;
+	hx_context(prog, &behind, &ahead);
+	if (!behind) return;
+	size_t n = ((off_t)behind < at) ? behind : (size_t)at;
+	char *buf = domalloc(n, "lookback()");
+	if (pread(ifd, buf, n, at - n) != (ssize_t)n) {
+		perror("Reading back the input");
+		exit(EXIT_FAILURE);
+	}
+	hx_stream_before(st, buf, n);
+	free(buf);
+} // lookback()
 
-} // editfile()
+off_t fromtail(const hx_program *prog, options_t opts, int ifd,
+				long *skip)
+{	/* =-N and =@-N. Searching back through the mapped input finds where
+	 * the edits start, everything before that is copied to stdout as it
+	 * is, the copy shared with the input where the fs allows. ifd is
+	 * left there to be read on from.
+	*/
+	struct stat sb;
+	char magic[8];
+	if (ifd == 0 || fstat(ifd, &sb) == -1 || !S_ISREG(sb.st_mode) ||
+		opts.follow || opts.journal || opts.compress || opts.checksum) {
+		fputs("A count from the end needs a file to edit, and not --follow,"
+				" --journal, --compress or --checksum\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	ssize_t n = pread(ifd, magic, sizeof(magic), 0);
+	if (n > 0 && zio_sniff(magic, n) != ZIO_PLAIN) {
+		fputs("A count from the end can't search compressed input\n",
+				stderr);
+		exit(EXIT_FAILURE);
+	}
+	size_t start = 0, len = sb.st_size;
+	*skip = 0;
+	if (len) {
+		char *in = mmap(NULL, len, PROT_READ, MAP_SHARED, ifd, 0);
+		if (in == MAP_FAILED) {
+			perror("mmap()");
+			exit(EXIT_FAILURE);
+		}
+		madvise(in, len, MADV_RANDOM);	// only the tail gets looked at
+		hx_tail(prog, in, len, &start, skip);
+		munmap(in, len);
+	}
+	copyrange(ifd, 0, 1, start);
+	if (lseek(ifd, start, SEEK_SET) == -1) {
+		perror("lseek()");
+		exit(EXIT_FAILURE);
+	}
+	return start;
+} // fromtail()
+
+int ispipe(const char *fn)
+{	/* a fifo, or /dev/stdin and the like, will do as input too */
+	struct stat sb;
+	if (stat(fn, &sb) == -1) return 0;
+	return S_ISFIFO(sb.st_mode) || S_ISCHR(sb.st_mode);
+} // ispipe()
@@ -0,0 +1,274 @@
+/*      incr.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* hexsed --update outfile. The input is taken in fixed size blocks and
+ * the manifest remembers for each a hash of its bytes, and of the
+ * maxlen - 1 after it which a match starting in it can reach, with the
+ * state the scan entered it in and where its output went. Next time a
+ * block with the same hash entered in the same state must give the same
+ * output as before, so that is copied from the old outfile, sharing the
+ * extents where the fs can. Only the other blocks are scanned. The new
+ * output is built beside outfile and renamed over it, the manifest
+ * follows it the same way.
+*/
+
+#include <sys/mman.h>
+#include <limits.h>
+#include "fileops.h"
+#include "incr.h"
+
+#define OUTBUF (256 * 1024)
+
+typedef struct outw {	// buffered, sequential writes to the new output
+	int fd;
+	char *buf;
+	size_t len;
+	uint64_t off;	// everything written so far, buffered or not
+} outw;
+
+static uint64_t blockhash(const char *p, size_t len);
+static hxm_entry *loadmanifest(const char *mfn, const char *outfn,
+								const hxm_head *want, hxm_head *got);
+static void savemanifest(const char *mfn, hxm_head *hd,
+							const hxm_entry *ent);
+static int outsink(void *ctx, const char *from, size_t len);
+static void outflush(outw *w);
+static void reuse(outw *w, int oldfd, uint64_t off, uint64_t len);
+
+void update(const char *fn, const hx_program *prog, const char *outfn,
+			int quiet)
+{
+	int ifd = doopen(fn, "r");
+	struct stat sb;
+	if (fstat(ifd, &sb) == -1) {
+		perror(fn);
+		exit(EXIT_FAILURE);
+	}
+	size_t n = sb.st_size;
+	const char *in = NULL;
+	if (n) {
+		in = mmap(NULL, n, PROT_READ, MAP_SHARED, ifd, 0);
+		if (in == MAP_FAILED) {
+			perror(fn);
+			exit(EXIT_FAILURE);
+		}
+		madvise((void *)in, n, MADV_SEQUENTIAL);
+	}
+	size_t behind, ahead;
+	hx_context(prog, &behind, &ahead);
+	size_t maxlen = hx_maxlen(prog) + ahead;	// the lookahead as well
+	if (behind) {	// hx_exec_part() can't see before a block
+		fprintf(stderr, "%s\n", hx_strerror(HX_ECONTEXT));
+		exit(EXIT_FAILURE);
+	}
+	size_t bs = HXM_BLOCKSIZE;
+	while (bs < 2 * maxlen) bs *= 2;	// a match never spans a block
+	size_t nb = (n + bs - 1) / bs;
+	size_t isize;
+	const void *image = hx_image(prog, &isize);
+	hxm_head hd = { HXM_MAGIC, HXM_VERSION, blockhash(image, isize), bs,
+					n, nb, 0, 0 };
+	char *mfn = domalloc(strlen(outfn) + 5, "update()");
+	sprintf(mfn, "%s.hxm", outfn);
+	hxm_head oh;
+	hxm_entry *old = loadmanifest(mfn, outfn, &hd, &oh);
+	int oldfd = old ? open(outfn, O_RDONLY | O_CLOEXEC) : -1;
+	if (oldfd == -1) {
+		free(old);
+		old = NULL;
+	}
+
+	char *tmpfn = domalloc(strlen(outfn) + 8, "update()");
+	sprintf(tmpfn, "%s.XXXXXX", outfn);
+	int tfd = mkstemp(tmpfn);
+	if (tfd == -1) {
+		perror(tmpfn);
+		exit(EXIT_FAILURE);
+	}
+	mode_t um = umask(0);	// mkstemp() gives 0600, want what open() would
+	umask(um);
+	fchmod(tfd, 0666 & ~um);
+	outw w = { tfd, domalloc(OUTBUF, "update()"), 0, 0 };
+	hxm_entry *ent = domalloc((nb + 1) * sizeof(hxm_entry), "update()");
+	int limited = (hx_edcount(prog) != LONG_MAX);
+	size_t delta = 0, rescanned = 0, i;
+	long count = 0;
+	for (i = 0; i < nb; i++) {
+		size_t s = i * bs;
+		size_t e = (s + bs < n) ? s + bs : n;
+		size_t hend = (e + maxlen - 1 < n) ? e + maxlen - 1 : n;
+		ent[i].hash = blockhash(in + s, hend - s);
+		ent[i].delta = delta;
+		ent[i].count = count;
+		ent[i].ooff = w.off;
+		if (old && i < oh.nblocks && old[i].hash == ent[i].hash &&
+			old[i].delta == delta && (!limited || old[i].count == count)) {
+			reuse(&w, oldfd, old[i].ooff, old[i + 1].ooff - old[i].ooff);
+			delta = old[i + 1].delta;
+			count += old[i + 1].count - old[i].count;
+			continue;
+		}
+		rescanned++;
+		size_t start = s + delta, used;
+		size_t limit = (e == n) ? n : e;	// the last block takes it all
+		int res = hx_exec_part(prog, in + start, hend - start,
+								limit - start, outsink, &w, &count, &used);
+		if (res != HX_OK) {
+			fprintf(stderr, "%s\n", hx_strerror(res));
+			exit(EXIT_FAILURE);
+		}
+		delta = start + used - e;
+	}
+	outflush(&w);
+	ent[nb] = (hxm_entry){ 0, delta, count, w.off };
+	if (fsync(tfd) == -1 || fstat(tfd, &sb) == -1) {
+		perror(tmpfn);
+		exit(EXIT_FAILURE);
+	}
+	hd.outsize = w.off;
+	hd.outmtime = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+	if (rename(tmpfn, outfn) == -1) {
+		perror(outfn);
+		unlink(tmpfn);
+		exit(EXIT_FAILURE);
+	}
+	close(tfd);
+	savemanifest(mfn, &hd, ent);
+	if (!quiet) {
+		char *what = (hx_op(prog) == 'd') ? "deletions" : "substitutions";
+		fprintf(stdout, "Did %li %s.\n", count, what);
+		fprintf(stdout, "Scanned %zu of %zu blocks.\n", rescanned, nb);
+	}
+	if (oldfd != -1) close(oldfd);
+	if (n) munmap((void *)in, n);
+	doclose(ifd);
+	free(w.buf);
+	free(ent);
+	free(old);
+	free(tmpfn);
+	free(mfn);
+} // update()
+
+static uint64_t blockhash(const char *p, size_t len)
+{	/* 64 bit multiply and fold, a word at a time, seeded with len */
+	const uint64_t m = 0xff51afd7ed558ccdULL;
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * m);
+	size_t i;
+	for (i = 0; i + 8 <= len; i += 8) {
+		uint64_t v;
+		memcpy(&v, p + i, 8);
+		h = (h ^ v) * m;
+		h ^= h >> 32;
+	}
+	uint64_t v = 0;
+	memcpy(&v, p + i, len - i);
+	h = (h ^ v) * m;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+} // blockhash()
+
+static hxm_entry *loadmanifest(const char *mfn, const char *outfn,
+								const hxm_head *want, hxm_head *got)
+{	/* The old manifest's entries if it was made by this program with the
+	 * same block size and the output it describes is still there as it
+	 * was left, else NULL and everything is scanned.
+	*/
+	int fd = open(mfn, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return NULL;
+	hxm_entry *ent = NULL;
+	struct stat sb, ob;
+	if (read(fd, got, sizeof(hxm_head)) != sizeof(hxm_head)) goto fail;
+	if (got->magic != HXM_MAGIC || got->version != HXM_VERSION ||
+		got->proghash != want->proghash ||
+		got->blocksize != want->blocksize) goto fail;
+	if (fstat(fd, &sb) == -1 || got->nblocks > (uint64_t)sb.st_size ||
+		(uint64_t)sb.st_size != sizeof(hxm_head) +
+		(got->nblocks + 1) * sizeof(hxm_entry)) goto fail;
+	if (stat(outfn, &ob) == -1 || (uint64_t)ob.st_size != got->outsize ||
+		ob.st_mtim.tv_sec * 1000000000LL + ob.st_mtim.tv_nsec !=
+		got->outmtime) goto fail;
+	size_t len = (got->nblocks + 1) * sizeof(hxm_entry);
+	ent = malloc(len);
+	if (!ent || read(fd, ent, len) != (ssize_t)len) goto fail;
+	uint64_t i;
+	for (i = 0; i < got->nblocks; i++) {	// must all lie in the output
+		if (ent[i].ooff > ent[i + 1].ooff) goto fail;
+	}
+	if (ent[got->nblocks].ooff != got->outsize) goto fail;
+	close(fd);
+	return ent;
+fail:
+	free(ent);
+	close(fd);
+	return NULL;
+} // loadmanifest()
+
+static void savemanifest(const char *mfn, hxm_head *hd,
+							const hxm_entry *ent)
+{
+	char *tmp = domalloc(strlen(mfn) + 5, "savemanifest()");
+	sprintf(tmp, "%s.new", mfn);
+	int fd = doopen(tmp, "w");
+	size_t len = (hd->nblocks + 1) * sizeof(hxm_entry);
+	if (write(fd, hd, sizeof(hxm_head)) != sizeof(hxm_head) ||
+		write(fd, ent, len) != (ssize_t)len || fsync(fd) == -1 ||
+		rename(tmp, mfn) == -1) {
+		perror(mfn);
+		unlink(tmp);
+		exit(EXIT_FAILURE);
+	}
+	doclose(fd);
+	free(tmp);
+} // savemanifest()
+
+static int outsink(void *ctx, const char *from, size_t len)
+{
+	outw *w = ctx;
+	while (len) {
+		size_t n = OUTBUF - w->len;
+		if (n > len) n = len;
+		if (from) {
+			memcpy(w->buf + w->len, from, n);
+			from += n;
+		} else {
+			memset(w->buf + w->len, 0, n);
+		}
+		w->len += n;
+		w->off += n;
+		len -= n;
+		if (w->len == OUTBUF) outflush(w);
+	}
+	return 0;
+} // outsink()
+
+static void outflush(outw *w)
+{
+	writeall(w->fd, w->buf, w->len);
+	w->len = 0;
+} // outflush()
+
+static void reuse(outw *w, int oldfd, uint64_t off, uint64_t len)
+{	/* output unchanged since last time, straight from the old file */
+	outflush(w);
+	copyrange(oldfd, off, w->fd, len);
+	w->off += len;
+} // reuse()
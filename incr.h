@@ -0,0 +1,55 @@
+/*      incr.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _INCR_H
+#define _INCR_H
+#include <stdint.h>
+#include "libhexsed.h"
+
+/* The sidecar manifest hexsed --update keeps beside its output, in host
+ * byte order. An hxm_head, then nblocks + 1 hxm_entry, the last of them
+ * only the state at the end of the input.
+*/
+#define HXM_MAGIC 0x314D5848	// "HXM1"
+#define HXM_VERSION 1
+#define HXM_BLOCKSIZE (1024 * 1024)	// at least, see update()
+
+typedef struct hxm_head {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t proghash;	// of the program image, see hx_image()
+	uint64_t blocksize;
+	uint64_t insize;
+	uint64_t nblocks;
+	uint64_t outsize;	// the output must still be as it was left
+	int64_t outmtime;	// in ns
+} hxm_head;
+
+typedef struct hxm_entry {
+	uint64_t hash;	// of the block and the maxlen - 1 bytes after it
+	uint64_t delta;	// the scan enters the block this far in
+	int64_t count;	// having made this many edits before it
+	uint64_t ooff;	// and having written this much output
+} hxm_entry;
+
+void update(const char *fn, const hx_program *prog, const char *outfn,
+			int quiet);
+
+#endif
@@ -0,0 +1,298 @@
+/*      journal.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* hexsed --journal and --resume. Every HXJ_INTERVAL seconds the input
+ * offset everything before which is edited, the output offset, and the
+ * edit count are checkpointed. Bytes the matcher was holding as a
+ * possible partial match all lie past the input offset, so they are
+ * simply read again. A resumed edit checks a window of the input and of
+ * the output each side of the checkpoint against the crcs recorded,
+ * cuts the output back to the checkpoint and carries on from there.
+ *
+ * In place (--in-place) every edit is the same length as what it
+ * replaces and is written into the input itself. Edits are collected
+ * until the next checkpoint, their offsets journaled, then they are
+ * written, and the checkpoint after them says they are all on disk.
+ * Between the two a crash may leave any of them torn; since all write
+ * the same bytes, --resume just writes every one of them again.
+*/
+
+#include "fileops.h"
+#include "stringops.h"
+#include "crc.h"
+#include "journal.h"
+
+static int readrec(journal *jn, hxj_rec *rec);
+static void putrec(journal *jn, hxj_rec *rec);
+static uint32_t window(int fd, uint64_t end, journal *jn);
+static void loadredo(journal *jn);
+static void writeedits(journal *jn);
+static void setdue(journal *jn);
+static void flushfd(int fd, const char *what);
+static void fail(const char *path, const char *why);
+
+journal *jn_open(const char *path, int resume, const hx_program *prog,
+					int ifd, int ofd)
+{
+	journal *jn = docalloc(1, sizeof(journal), "jn_open()");
+	jn->path = dostrdup(path);
+	jn->ifd = ifd;
+	jn->ofd = ofd;
+	jn->rfd = -1;
+	size_t isize;
+	const void *image = hx_image(prog, &isize);
+	uint32_t progcrc = crc32c(0, image, isize);
+	jn->rep = hx_replacement(prog, &jn->rlen);
+	struct stat sb;
+	if (fstat(ifd, &sb) == -1) {
+		perror("fstat()");
+		exit(EXIT_FAILURE);
+	}
+	if (ofd != -1) {
+		jn->rfd = open("/proc/self/fd/1", O_RDONLY | O_CLOEXEC);
+		if (jn->rfd == -1) {
+			perror("Reading back the output");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!resume) {
+		jn->jfd = doopen(path, "w+");
+		hxj_rec rec = { HXJ_MAGIC, HXJ_VERSION, 0, sb.st_size, 0, 0, 0, 0,
+						0, progcrc, 0, 0, 0, 0 };
+		putrec(jn, &rec);
+		setdue(jn);
+		return jn;
+	}
+
+	jn->jfd = doopen(path, "r+");
+	hxj_rec *rec = &jn->rec;
+	if (readrec(jn, rec) == -1) fail(path, "no good checkpoint in it");
+	if (rec->progcrc != progcrc) fail(path, "made by another expression");
+	if (rec->insize != (uint64_t)sb.st_size)
+		fail(path, "the input has changed size");
+	if (rec->nredo) {
+		loadredo(jn);
+		writeedits(jn);
+		hxj_rec r = *rec;
+		r.nredo = 0;
+		r.redocrc = 0;
+		putrec(jn, &r);
+	}
+	if (rec->icrc != window(ifd, rec->ioff, jn))
+		fail(path, "the input has changed");
+	if (ofd != -1) {
+		if (fstat(ofd, &sb) == -1 || (uint64_t)sb.st_size < rec->ooff)
+			fail(path, "the output is shorter than the checkpoint, was it"
+					" opened with > rather than 1<>?");
+		if (rec->ocrc != window(jn->rfd, rec->ooff, jn))
+			fail(path, "the output has changed");
+		if (ftruncate(ofd, rec->ooff) == -1 ||
+			lseek(ofd, rec->ooff, SEEK_SET) == -1) {
+			perror("Cutting back the output");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (lseek(ifd, rec->ioff, SEEK_SET) == -1) {
+		perror("Seeking the input");
+		exit(EXIT_FAILURE);
+	}
+	setdue(jn);
+	return jn;
+} // jn_open()
+
+int jn_due(const journal *jn)
+{	/* cheap enough to ask after every block */
+	if (jn->nredo >= HXJ_MAXREDO) return 1;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > jn->due.tv_sec ||
+			(now.tv_sec == jn->due.tv_sec && now.tv_nsec >= jn->due.tv_nsec);
+} // jn_due()
+
+void jn_checkpoint(journal *jn, uint64_t ioff, uint64_t ooff, long fcount)
+{	/* The caller has seen all output before ooff handed to the kernel.
+	 * In place, the edits collected are written first, see above.
+	*/
+	hxj_rec rec = jn->rec;
+	rec.ioff = ioff;
+	rec.ooff = ooff;
+	rec.fcount = fcount;
+	if (jn->ofd != -1) {
+		flushfd(jn->ofd, "the output");
+		struct stat sb;	// output that ends in a hole isn't that long yet
+		if (fstat(jn->ofd, &sb) == 0 && (uint64_t)sb.st_size < ooff &&
+			ftruncate(jn->ofd, ooff) == -1) {
+			perror("ftruncate()");
+			exit(EXIT_FAILURE);
+		}
+		rec.ocrc = window(jn->rfd, ooff, NULL);
+	}
+	if (jn->nredo) {
+		size_t len = jn->nredo * sizeof(uint64_t);
+		if (pwrite(jn->jfd, jn->redo, len, HXJ_REDOOFF) != (ssize_t)len) {
+			perror(jn->path);
+			exit(EXIT_FAILURE);
+		}
+		rec.nredo = jn->nredo;
+		rec.redocrc = crc32c(0, jn->redo, len);
+		rec.icrc = window(jn->ifd, ioff, jn);	// as it will be
+		putrec(jn, &rec);
+		writeedits(jn);
+		rec = jn->rec;
+		rec.nredo = 0;
+		rec.redocrc = 0;
+	} else {
+		rec.icrc = window(jn->ifd, ioff, NULL);
+	}
+	putrec(jn, &rec);
+	setdue(jn);
+} // jn_checkpoint()
+
+int jn_match(void *ctx, off_t at, const char *found, size_t mlen)
+{	/* an hx_match, in place the edit is only noted for now */
+	journal *jn = ctx;
+	(void)found;
+	if (mlen != jn->rlen) {
+		fputs("An edit in place must be the same length as what it"
+				" replaces\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (jn->nredo == jn->cap) {
+		jn->cap = jn->cap ? 2 * jn->cap : 1024;
+		jn->redo = realloc(jn->redo, jn->cap * sizeof(uint64_t));
+		if (!jn->redo) {
+			perror("jn_match()");
+			exit(EXIT_FAILURE);
+		}
+	}
+	jn->redo[jn->nredo++] = at;
+	return 0;
+} // jn_match()
+
+void jn_close(journal *jn, uint64_t ioff, uint64_t ooff, long fcount)
+{	/* All done, the journal has nothing more to say. */
+	if (jn->nredo) jn_checkpoint(jn, ioff, ooff, fcount);
+	if (jn->ofd != -1) flushfd(jn->ofd, "the output");
+	doclose(jn->jfd);
+	if (unlink(jn->path) == -1) perror(jn->path);
+	if (jn->rfd != -1) close(jn->rfd);
+	free(jn->redo);
+	free(jn->path);
+	free(jn);
+} // jn_close()
+
+static int readrec(journal *jn, hxj_rec *rec)
+{	/* the newer good slot, -1 if neither is */
+	hxj_rec r[2];
+	int i, best = -1;
+	for (i = 0; i < 2; i++) {
+		if (pread(jn->jfd, &r[i], sizeof(hxj_rec), i * sizeof(hxj_rec))
+			!= sizeof(hxj_rec)) continue;
+		if (r[i].magic != HXJ_MAGIC || r[i].version != HXJ_VERSION ||
+			r[i].crc != crc32c(0, &r[i], offsetof(hxj_rec, crc))) continue;
+		if (best == -1 || r[i].seq > r[best].seq) best = i;
+	}
+	if (best == -1) return -1;
+	*rec = r[best];
+	return 0;
+} // readrec()
+
+static void putrec(journal *jn, hxj_rec *rec)
+{	/* into the slot not holding the last checkpoint, then make it so */
+	rec->seq = jn->rec.seq + 1;
+	rec->crc = crc32c(0, rec, offsetof(hxj_rec, crc));
+	if (pwrite(jn->jfd, rec, sizeof(hxj_rec), (rec->seq & 1) *
+				sizeof(hxj_rec)) != sizeof(hxj_rec)) {
+		perror(jn->path);
+		exit(EXIT_FAILURE);
+	}
+	flushfd(jn->jfd, jn->path);
+	jn->rec = *rec;
+} // putrec()
+
+static uint32_t window(int fd, uint64_t end, journal *jn)
+{	/* CRC32C of the HXJ_WINDOW bytes before end, or as many as there
+	 * are. With jn, as they will be once its pending edits are written.
+	*/
+	uint64_t start = (end > HXJ_WINDOW) ? end - HXJ_WINDOW : 0;
+	size_t len = end - start;
+	char *buf = domalloc(len + 1, "window()");
+	ssize_t n = pread(fd, buf, len, start);
+	if (n == -1) {
+		perror("pread()");
+		exit(EXIT_FAILURE);
+	}
+	memset(buf + n, 0, len - n);	// the tail of a hole not written yet
+	size_t i;
+	for (i = 0; jn && i < jn->nredo; i++) {
+		uint64_t at = jn->redo[i];
+		if (at + jn->rlen <= start || at >= end) continue;
+		uint64_t s = (at > start) ? at : start;
+		uint64_t e = (at + jn->rlen < end) ? at + jn->rlen : end;
+		memcpy(buf + (s - start), jn->rep + (s - at), e - s);
+	}
+	uint32_t crc = crc32c(0, buf, len);
+	free(buf);
+	return crc;
+} // window()
+
+static void loadredo(journal *jn)
+{	/* resumed where the edits of the checkpoint may be torn */
+	size_t len = jn->rec.nredo * sizeof(uint64_t);
+	jn->redo = domalloc(len, "loadredo()");
+	jn->cap = jn->nredo = jn->rec.nredo;
+	if (pread(jn->jfd, jn->redo, len, HXJ_REDOOFF) != (ssize_t)len ||
+		crc32c(0, jn->redo, len) != jn->rec.redocrc)
+		fail(jn->path, "the edits to write again are damaged");
+} // loadredo()
+
+static void writeedits(journal *jn)
+{	/* every pending edit, and on disk before they are forgotten */
+	size_t i;
+	for (i = 0; i < jn->nredo; i++) {
+		if (pwrite(jn->ifd, jn->rep, jn->rlen, jn->redo[i]) !=
+			(ssize_t)jn->rlen) {
+			perror("Editing in place");
+			exit(EXIT_FAILURE);
+		}
+	}
+	flushfd(jn->ifd, "the input");
+	jn->nredo = 0;
+} // writeedits()
+
+static void setdue(journal *jn)
+{
+	clock_gettime(CLOCK_MONOTONIC, &jn->due);
+	jn->due.tv_sec += HXJ_INTERVAL;
+} // setdue()
+
+static void flushfd(int fd, const char *what)
+{
+	if (fdatasync(fd) == -1) {
+		perror(what);
+		exit(EXIT_FAILURE);
+	}
+} // flushfd()
+
+static void fail(const char *path, const char *why)
+{
+	fprintf(stderr, "Can't resume from %s, %s\n", path, why);
+	exit(EXIT_FAILURE);
+} // fail()
@@ -0,0 +1,83 @@
+/*      journal.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+#include <stdint.h>
+#include <time.h>
+#include "libhexsed.h"
+
+/* The --journal file, in host byte order. Two hxj_rec slots written in
+ * turn, the one with a good crc and the higher seq is the checkpoint.
+ * In place the offsets of edits about to be written are put at
+ * HXJ_REDOOFF first, so that after a crash they can all be written
+ * again whether or not they got to the disk.
+*/
+#define HXJ_MAGIC 0x314A5848	// "HXJ1"
+#define HXJ_VERSION 1
+#define HXJ_REDOOFF 4096
+#define HXJ_WINDOW (1024 * 1024)	// checked each side on --resume
+#define HXJ_INTERVAL 10	// seconds between checkpoints
+#define HXJ_MAXREDO (64 * 1024)	// in place edits held at most
+
+typedef struct hxj_rec {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t seq;
+	uint64_t insize;
+	uint64_t ioff;	// input before here is done with
+	uint64_t ooff;	// and its output is on disk, before here
+	int64_t fcount;	// edits done so far, the program's =count limits it
+	uint64_t nredo;	// in place, edits at HXJ_REDOOFF to write again
+	uint32_t redocrc;
+	uint32_t progcrc;	// CRC32C of the program image
+	uint32_t icrc;	// of the HXJ_WINDOW bytes of input before ioff
+	uint32_t ocrc;	// and of output before ooff
+	uint32_t pad;
+	uint32_t crc;	// of everything before it
+} hxj_rec;
+
+typedef struct journal {
+	int jfd;
+	char *path;
+	int ifd;
+	int ofd;	// -1 when editing in place
+	int rfd;	// ofd opened again to read back
+	hxj_rec rec;	// the last checkpoint
+	const char *rep;	// in place, what every edit writes
+	size_t rlen;
+	uint64_t *redo;	// edits since the last checkpoint
+	size_t nredo;
+	size_t cap;
+	struct timespec due;
+} journal;
+
+journal *jn_open(const char *path, int resume, const hx_program *prog,
+					int ifd, int ofd);
+int jn_due(const journal *jn);
+void jn_checkpoint(journal *jn, uint64_t ioff, uint64_t ooff, long fcount);
+int jn_match(void *ctx, off_t at, const char *found, size_t mlen);
+void jn_close(journal *jn, uint64_t ioff, uint64_t ooff, long fcount);
+/* The fds are positioned, and jn->rec gives where to carry on from.
+ * Checkpoint whenever jn_due(), with the output all written. In place
+ * jn_match() is the hx_match that collects the edits.
+*/
+
+#endif
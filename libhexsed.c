@@ -0,0 +1,1703 @@
+/*      libhexsed.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libhexsed.h"
+#include "arena.h"
+#include "dict.h"
+
+/* A compiled program is one flat image, this header followed by the
+ * byte strings it refers to by their offset from the start of the image.
+ * There are no pointers in it, so hx_save() writes it out as it is and
+ * hx_load() maps a saved one and runs it wherever it lands. The image is
+ * always an mmap()ed region, hx_free() need not know where it came from.
+*/
+#define HXP_MAGIC 0x00505848	// "HXP\0", reads wrong on the other endian
+#define HXP_VERSION 8
+
+struct hx_program {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;		// of the whole image
+	int64_t edcount;
+	int64_t skip;	// matches passed over before editing, =@N
+	int64_t fromend;	// N of =-N or =@-N
+	uint64_t flen;
+	uint64_t rlen;
+	uint64_t findoff;	// the find string
+	uint64_t repoff;	// the replacement, if any
+	int32_t op;
+	int32_t allzero;	// a find string is all 0x00
+	uint64_t maxlen;	// longest possible match
+	uint64_t minlen;	// and shortest
+	uint64_t maskoff;	// per find byte 1, or 0 for ??, 0 if none is ??
+	uint64_t aoff;	// the longest run of find bytes with no ??, which
+	uint64_t alen;	// is what gets searched for
+	uint64_t segoff;	// the replacement in pieces, when it has a \N
+	uint64_t nseg;
+	uint64_t outlen;	// of the replacement once put together
+	uint64_t behind;	// lookbehind and lookahead lengths, 0 if none
+	uint64_t ahead;
+	uint64_t ctxoff;	// their bytes, each followed by its mask
+	int32_t bneg;	// (?<! and (?! rather than (?<= and (?=
+	int32_t aneg;
+	dictsec dict;	// npat is 0 unless it came from hx_compile_dict()
+	uint64_t formoff;	// for hx_compile_text(), the text as each encoding
+	uint64_t nform;	// has it, to tell which one a match is in
+	uint64_t foldoff;	// per find byte 0x20 for a letter, 0 without (?i)
+};
+
+typedef struct hxp_seg {	// a piece of a replacement with \N in it
+	uint64_t cap;	// 1 for bytes of the match, 0 of the replacement
+	uint64_t off;
+	uint64_t len;
+} hxp_seg;
+
+typedef struct hxp_form {	// the search text in one encoding
+	uint32_t enc;	// HXT_UTF8, HXT_UTF16LE or HXT_UTF16BE
+	uint32_t fold;	// 1 when either case of an ASCII letter matches
+	uint64_t off;
+	uint64_t len;
+} hxp_form;
+
+enum { HXT_UTF8, HXT_UTF16LE, HXT_UTF16BE, HXT_NENC };
+static const char *encname[HXT_NENC] = { "utf8", "utf16le", "utf16be" };
+#define HXT_MAXFOLD 16	// letters in a folded form, 2^16 spellings of it
+
+#define HXP_MAXGROUP 9	// \1 to \9, \0 is the whole match
+#define NORM_MAXLEN 4	// longest sequence op n changes, and the byte after
+
+#define TOFIND(px) ((const char *)(px) + (px)->findoff)
+#define TOREPLACE(px) ((const char *)(px) + (px)->repoff)
+#define MASK(px) ((const char *)(px) + (px)->maskoff)
+#define FOLD(px) ((const char *)(px) + (px)->foldoff)
+#define SEGS(px) ((const hxp_seg *)((const char *)(px) + (px)->segoff))
+#define BEHIND(px) ((const char *)(px) + (px)->ctxoff)
+#define AHEAD(px) (BEHIND(px) + 2 * (px)->behind)
+#define FORMS(px) ((const hxp_form *)((const char *)(px) + (px)->formoff))
+
+typedef struct pattern {	// an expression taken apart for mkimage()
+	char *find;
+	char *mask;	// NULL when no byte is ??
+	size_t flen;
+	size_t gpos[HXP_MAXGROUP + 1];	// where each ( ) group is in find
+	size_t glen[HXP_MAXGROUP + 1];
+	int ngroup;
+	char *rep;	// the bytes given in the replacement
+	size_t rlen;
+	hxp_seg *seg;	// how they and \N put it together, if there's a \N
+	size_t nseg;
+	size_t outlen;
+	char *ctx[2];	// lookbehind and lookahead, bytes then mask
+	size_t clen[2];
+	int neg[2];
+	char *fold;	// (?i), see foldcase(), else NULL
+	hxp_form *form;	// hx_compile_text(), offsets here are into fbytes
+	size_t nform;
+	char *fbytes;
+	size_t fblen;
+} pattern;
+
+struct hx_stream {
+	const hx_program *prog;
+	hx_sink sink;
+	void *ctx;
+	long fcount;
+	long skip;	// matches still to be passed over
+	size_t keep;	// bytes held back at the end of each feed
+	off_t done;	// input offset of the first byte not yet scanned
+	hx_match match;
+	void *mctx;
+	size_t clen;
+	char *hist;	// the input just before what is scanned next, for
+	size_t hlen;	// a lookbehind, in the same allocation as stitch
+	char stitch[];	// the held back bytes, plus keep more to join on
+};
+
+typedef unsigned char v16 __attribute__((vector_size(16)));
+
+#define ZCHUNK (64 * 1024)
+static const char zeros[ZCHUNK];	// stands in for holes that must be scanned
+
+#define EMIT(st, p, n) do { \
+	if ((n) && (st)->sink((st)->ctx, (p), (n))) return HX_ESINK; \
+	} while (0)
+
+#define EMITREP(st, px, found) do { \
+	if (!(px)->nseg) { \
+		EMIT((st), TOREPLACE(px), (px)->rlen); \
+	} else if (emitsegs((st), (found))) { \
+		return HX_ESINK; \
+	} } while (0)
+
+static int parsectx(char *hex, arena *ar, pattern *pt, char **core);
+static int ctxbytes(const char *hex, size_t len, arena *ar, pattern *pt,
+					int which);
+static int parsefind(const char *hex, arena *ar, pattern *pt);
+static int foldcase(arena *ar, pattern *pt);
+static int parserep(const char *hex, arena *ar, pattern *pt);
+static int hexpair(const char *cp, char *byte);
+static int literal(const char *cp, char *to, size_t *used);
+static int compile(const char *expr, const char *dictpath,
+					const char *text, const char *encs, hx_program **prog);
+static hx_program *mkimage(int op, long edcount, long skip, long fromend,
+					const pattern *pt, const dtrie *dt);
+static int newstream(const hx_program *prog, long skip, hx_sink sink,
+						void *ctx, hx_stream **st);
+static const char *ffind(const hx_program *px, const char *from,
+							size_t pos, size_t len, const char *hist,
+							size_t hlen);
+static const char *rfind(const hx_program *px, const char *from,
+							size_t end, size_t len);
+static const char *cfind(const hx_program *px, const char *s,
+							const char *end);
+static int prefixof(const hx_program *px, const char *p, size_t n);
+static int foldeq(const char *f, const char *fold, const char *mask,
+					const char *p, size_t n);
+static int ctxok(const hx_program *px, const char *from, size_t len,
+					const char *found, const char *hist, size_t hlen);
+static int masked(const char *ctx, const char *mask, const char *p,
+					size_t n, int fold);
+static void remember(hx_stream *st, const char *from, size_t len);
+static long fwdcount(const hx_program *px, const char *from, size_t pos,
+						size_t len);
+static int emitsegs(hx_stream *st, const char *found);
+static const char *nfind(const char *from, size_t pos, size_t len,
+							size_t *mlen);
+static int nspace(const char *found, size_t mlen, const char *end);
+static int textforms(const char *text, const char *encs, arena *ar,
+						pattern *pt, dtrie *dt);
+static size_t encode(uint32_t c, int enc, unsigned char *to);
+static int samefold(const char *a, const char *b, size_t len, int enc);
+static int badimage(const hx_program *px, size_t size);
+static int scan(hx_stream *st, const char *from, size_t len,
+				size_t limit, size_t *used);
+static int fdsink(void *ctx, const char *from, size_t len);
+static size_t settled(const hx_stream *st, const char *from, size_t len,
+						size_t limit);
+
+const char *hx_strerror(int err)
+{
+	switch (err)
+	{
+		case HX_OK: return "Success";
+		case HX_EFORM: return "Badly formed expression";
+		case HX_EZEROFIND: return "Zero length search string";
+		case HX_EZEROREPL: return "Zero length replacement string";
+		case HX_EPAIR: return "Each hex value must be input as a pair,"
+								" eg 00..0F etc";
+		case HX_EHEX: return "Invalid hex chars";
+		case HX_ENOMEM: return "Out of memory";
+		case HX_EIO: return "I/O error";
+		case HX_ESINK: return "Output refused";
+		case HX_EPROTO: return "Bad request";
+		case HX_EPROG: return "Not a usable compiled program";
+		case HX_ECOUNT: return "That count needs the whole input at once";
+		case HX_ECONTEXT: return "A lookbehind needs the input before it";
+	} // switch()
+	return "Unknown error";
+} // hx_strerror()
+
+int hx_compile(const char *expr, hx_program **prog)
+{
+	return compile(expr, NULL, NULL, NULL, prog);
+} // hx_compile()
+
+int hx_compile_dict(const char *expr, const char *dictpath,
+					hx_program **prog)
+{
+	return compile(expr, dictpath, NULL, NULL, prog);
+} // hx_compile_dict()
+
+int hx_compile_text(const char *expr, const char *text,
+					const char *encodings, hx_program **prog)
+{
+	return compile(expr, NULL, text, encodings, prog);
+} // hx_compile_text()
+
+static int compile(const char *expr, const char *dictpath,
+					const char *text, const char *encs, hx_program **prog)
+{	/* Build an hx_program from expr, [=count]/find/[replace/]op, where
+	 * find is empty when the patterns come from dictpath, or from text in
+	 * each of encs, instead. The arena only holds the pieces while the
+	 * expression is taken apart.
+	*/
+	int multi = (dictpath || text);
+	*prog = NULL;
+	arena *ar = ar_new(1024);
+	if (!ar) return HX_ENOMEM;
+	char *buf = ar_strdup(ar, expr);
+	if (!buf) {
+		ar_free(ar);
+		return HX_ENOMEM;
+	}
+	char *cp;
+	long edcount, skip = 0, fromend = 0;
+	int err = HX_OK;
+	/* Adding the ability to specify a count of patterns to be edited.
+	 * =N the first N, =-N the last N, =@N only the Nth and =@-N only
+	 * the Nth from the end.
+	*/
+	if (buf[0] == '=') {
+		cp = &buf[1];
+		int nth = (*cp == '@');
+		if (nth) cp++;
+		int back = (*cp == '-');
+		if (back) cp++;
+		edcount = isdigit(*cp) ? strtol(cp, NULL, 10) : -1;
+		while (isdigit(*cp)) cp++;
+		buf = cp;
+		if ((nth || back) && edcount < 1) err = HX_EFORM;
+		if (edcount < 0 || edcount == LONG_MAX) err = HX_EFORM;
+		if (back) fromend = edcount;
+		if (nth) {
+			if (!back) skip = edcount - 1;
+			edcount = 1;
+		}
+	} else {
+		edcount = LONG_MAX;
+	}
+	if (fromend && multi) err = HX_EFORM;	// no searching back there
+	if (err) goto fail;
+	size_t len = strlen(buf);
+	// test that expr has properly formed separators and command.
+	int count = 0;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (buf[i] == '/') {
+			count++;
+		}
+	}
+	char op = (len) ? buf[len-1] : 0;
+	if (len < 3 || buf[0] != '/' || buf[len - 2] != '/') err = HX_EFORM;
+	if (!op || !strchr("dsaiben", op)) err = HX_EFORM;
+	int norep = (op == 'd' || op == 'b' || op == 'e' || op == 'n');
+	if (norep) {
+		if (count != 2) err = HX_EFORM;
+	} else {
+		if (count != 3) err = HX_EFORM;
+	}
+	if (err) goto fail;
+
+	// split out the hex lists, in place
+	char *tofind = buf + 1;
+	char *ep = strchr(tofind, '/');
+	*ep = 0;
+	char *toreplace = NULL;
+	if (!norep) {
+		toreplace = ep + 1;
+		ep = strchr(toreplace, '/');
+		*ep = 0;
+	}
+	// check that we don't have 0 length strings
+	pattern pt;
+	memset(&pt, 0, sizeof(pt));
+	if (op == 'n') {	// //n, it knows what it looks for
+		if (*tofind || multi || fromend) err = HX_EFORM;
+	} else {
+		if (multi && *tofind) err = HX_EFORM;	// one or the other
+		else if (!multi && !*tofind) err = HX_EZEROFIND;
+		else if (op == 's' && !*toreplace) err = HX_EZEROREPL;
+		int nocase = (strncmp(tofind, "(?i)", 4) == 0);
+		if (nocase) tofind += 4;
+		if (!err) err = parsectx(tofind, ar, &pt, &tofind);
+		if (!err) err = parsefind(tofind, ar, &pt);
+		if (!err && !multi && !pt.flen) err = HX_EZEROFIND;	// just ( )
+		if (!err && nocase) err = foldcase(ar, &pt);
+		if (!err && toreplace) err = parserep(toreplace, ar, &pt);
+		if (!err && multi && pt.nseg) err = HX_EFORM;	// no \N there
+		if (!err && op == 's' && !pt.outlen) err = HX_EZEROREPL;
+	}
+	if (err) goto fail;
+
+	dtrie dt = {0};
+	if (dictpath) err = dt_build(dictpath, &dt);
+	if (text) err = textforms(text, encs, ar, &pt, &dt);
+	if (err) goto fail;
+	*prog = mkimage(op, edcount, skip, fromend, &pt, multi ? &dt : NULL);
+	if (!*prog) err = HX_ENOMEM;
+	dt_free(&dt);
+fail:
+	ar_free(ar);
+	return err;
+} // compile()
+
+void hx_free(hx_program *prog)
+{
+	if (prog) munmap(prog, prog->size);
+} // hx_free()
+
+int hx_save(const hx_program *prog, const char *path)
+{	/* The image goes out exactly as it is in memory. */
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) return HX_EIO;
+	int res = fdsink(&fd, (const char *)prog, prog->size);
+	if (close(fd) == -1) res = -1;
+	if (res) {
+		unlink(path);
+		return HX_EIO;
+	}
+	return HX_OK;
+} // hx_save()
+
+int hx_load(const char *path, hx_program **prog)
+{	/* Map a saved image and check that it is one of ours and that every
+	 * offset in it stays inside it. Nothing is parsed or copied, pages
+	 * come in as the run touches them.
+	*/
+	*prog = NULL;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return HX_EIO;
+	struct stat sb;
+	if (fstat(fd, &sb) == -1) {
+		close(fd);
+		return HX_EIO;
+	}
+	if (!S_ISREG(sb.st_mode) || (size_t)sb.st_size < sizeof(hx_program)) {
+		close(fd);
+		return HX_EPROG;
+	}
+	hx_program *px = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (px == MAP_FAILED) return HX_EIO;
+	if (badimage(px, sb.st_size)) {
+		munmap(px, sb.st_size);
+		return HX_EPROG;
+	}
+	*prog = px;
+	return HX_OK;
+} // hx_load()
+
+int hx_op(const hx_program *prog)
+{	/* the op char, 'd', 's', 'a' or 'i' */
+	return prog->op;
+} // hx_op()
+
+int hx_stream_new(const hx_program *prog, hx_sink sink, void *ctx,
+					hx_stream **st)
+{
+	*st = NULL;
+	if (prog->fromend) return HX_ECOUNT;
+	return newstream(prog, prog->skip, sink, ctx, st);
+} // hx_stream_new()
+
+int hx_stream_tail(const hx_program *prog, long skip, hx_sink sink,
+					void *ctx, hx_stream **st)
+{	/* skip is from hx_tail() */
+	return newstream(prog, skip, sink, ctx, st);
+} // hx_stream_tail()
+
+static int newstream(const hx_program *prog, long skip, hx_sink sink,
+						void *ctx, hx_stream **st)
+{
+	// most bytes a partial match, and what it looks ahead at, spans
+	size_t keep = prog->maxlen - 1 + prog->ahead;
+	hx_stream *sx = malloc(sizeof(hx_stream) + 2 * keep + 1 + prog->behind);
+	*st = sx;
+	if (!sx) return HX_ENOMEM;
+	sx->prog = prog;
+	sx->sink = sink;
+	sx->ctx = ctx;
+	sx->fcount = 0;
+	sx->skip = skip;
+	sx->keep = keep;
+	sx->done = 0;
+	sx->match = NULL;
+	sx->mctx = NULL;
+	sx->clen = 0;
+	sx->hist = sx->stitch + 2 * keep + 1;
+	sx->hlen = 0;
+	return HX_OK;
+} // newstream()
+
+int hx_feed(hx_stream *st, const char *from, size_t len)
+{	/* from is only read, never written, the edited bytes go to the
+	 * sink. Only bytes that could still be the start of a match are held
+	 * back, at most keep of them, copied into the small stitch buffer to
+	 * be joined to the next feed.
+	*/
+	size_t used, off = 0;
+	size_t keep = st->keep;
+	int res;
+	if (st->clen) {
+		size_t k = (len < keep) ? len : keep;
+		memcpy(st->stitch + st->clen, from, k);
+		size_t tot = st->clen + k;
+		size_t limit = (tot > keep) ? tot - keep : 0;
+		if (k == len) limit = settled(st, st->stitch, tot, limit);
+		res = scan(st, st->stitch, tot, limit, &used);
+		if (res) return res;
+		if (used < st->clen) {	// len < keep, everything is held
+			memmove(st->stitch, st->stitch + used, tot - used);
+			st->clen = tot - used;
+			return HX_OK;
+		}
+		off = used - st->clen;
+		st->clen = 0;
+	}
+	from += off;
+	len -= off;
+	size_t limit = (len > keep) ? len - keep : 0;
+	limit = settled(st, from, len, limit);
+	res = scan(st, from, len, limit, &used);
+	if (res) return res;
+	st->clen = len - used;
+	memcpy(st->stitch, from + used, st->clen);
+	return HX_OK;
+} // hx_feed()
+
+int hx_feed_zeros(hx_stream *st, off_t len)
+{	/* A hole reads as 0x00. Unless every byte of the find string is
+	 * 0x00 a match can only overlap a hole at one of its ends, so just
+	 * keep bytes of each end are scanned, and the rest goes to the sink
+	 * as a hole again without being looked at.
+	*/
+	off_t edge = st->keep;
+	int res;
+	int canmatch = st->prog->allzero && st->fcount < st->prog->edcount;
+	if (canmatch || len <= 2 * edge) {
+		while (len) {
+			size_t n = (len < ZCHUNK) ? (size_t)len : ZCHUNK;
+			res = hx_feed(st, zeros, n);
+			if (res) return res;
+			len -= n;
+		}
+		return HX_OK;
+	}
+	res = hx_feed(st, zeros, edge);
+	if (res) return res;
+	// what is held now is 0x00 that can't start a match, so it joins
+	if (st->sink(st->ctx, NULL, st->clen + len - 2 * edge))
+		return HX_ESINK;
+	remember(st, NULL, st->clen + len - 2 * edge);
+	st->done += st->clen + len - 2 * edge;
+	st->clen = 0;
+	return hx_feed(st, zeros, edge);
+} // hx_feed_zeros()
+
+int hx_flush(hx_stream *st)
+{	/* end of input, whatever is held back goes out now */
+	size_t used;
+	int res = scan(st, st->stitch, st->clen, st->clen, &used);
+	st->clen = 0;
+	return res;
+} // hx_flush()
+
+long hx_count(const hx_stream *st)
+{	/* edits done so far */
+	return st->fcount;
+} // hx_count()
+
+void hx_stream_free(hx_stream *st)
+{
+	free(st);
+} // hx_stream_free()
+
+void hx_stream_matches(hx_stream *st, hx_match match, void *ctx)
+{	/* match is called for every edit from now on */
+	st->match = match;
+	st->mctx = ctx;
+} // hx_stream_matches()
+
+off_t hx_offset(const hx_stream *st)
+{
+	return st->done;
+} // hx_offset()
+
+void hx_stream_resume(hx_stream *st, off_t offset, long count)
+{	/* the next byte fed is at offset */
+	st->done = offset;
+	st->fcount = count;
+} // hx_stream_resume()
+
+void hx_stream_before(hx_stream *st, const char *from, size_t len)
+{
+	remember(st, from, len);
+} // hx_stream_before()
+
+void hx_context(const hx_program *prog, size_t *behind, size_t *ahead)
+{
+	*behind = prog->behind;
+	*ahead = prog->ahead;
+} // hx_context()
+
+int hx_istext(const hx_program *prog)
+{
+	return prog->nform != 0;
+} // hx_istext()
+
+const char *hx_encoding(const hx_program *prog, const char *found,
+						size_t mlen)
+{	/* Which of the forms hx_compile_text() searched for found is. */
+	const hxp_form *fm = FORMS(prog);
+	const char *image = (const char *)prog;
+	uint64_t i;
+	for (i = 0; i < prog->nform; i++) {
+		if (fm[i].len != mlen) continue;
+		const char *p = image + fm[i].off;
+		if (fm[i].fold ? samefold(p, found, mlen, fm[i].enc)
+						: !memcmp(p, found, mlen))
+			return encname[fm[i].enc];
+	}
+	return NULL;
+} // hx_encoding()
+
+int hx_exec(const hx_program *prog, const char *from, size_t len,
+				hx_sink sink, void *ctx, long *count)
+{	/* The whole input is in memory so nothing needs holding back. */
+	hx_stream *st;
+	size_t used, start = 0;
+	long skip = prog->skip;
+	if (prog->fromend) hx_tail(prog, from, len, &start, &skip);
+	if (start && sink(ctx, from, start)) return HX_ESINK;
+	int res = newstream(prog, skip, sink, ctx, &st);
+	if (res) return res;
+	remember(st, from, start);
+	res = scan(st, from + start, len - start, len - start, &used);
+	if (count) *count = st->fcount;
+	hx_stream_free(st);
+	return res;
+} // hx_exec()
+
+int hx_record(hx_stream *st, const char *from, size_t len)
+{
+	const hx_program *px = st->prog;
+	size_t start = 0, used;
+	st->fcount = 0;
+	st->skip = px->skip;
+	st->clen = 0;	// nothing carries over from the last record
+	st->hlen = 0;
+	if (px->fromend) hx_tail(px, from, len, &start, &st->skip);
+	EMIT(st, from, start);
+	st->done += start;
+	remember(st, from, start);
+	return scan(st, from + start, len - start, len - start, &used);
+} // hx_record()
+
+int hx_tail(const hx_program *prog, const char *from, size_t len,
+				size_t *start, long *skip)
+{	/* Searching back finds every occurrence, but forward the matches
+	 * never overlap, so where occurrences do it is the forward scan that
+	 * counts. From an occurrence with no other overlapping it from before
+	 * a forward scan makes the same matches the whole scan would, so go
+	 * back until there is such a place with at least N matches after it.
+	 * Each forward count that falls short doubles how far back to go next.
+	*/
+	*start = 0;
+	*skip = prog->skip;
+	long need = prog->fromend;
+	if (!need) return HX_OK;
+	size_t plen = prog->flen;
+	const char *p = rfind(prog, from, len, len);
+	long seen = 0, want = need;
+	if (!p) {	// nothing to edit
+		*start = len;
+		return HX_OK;
+	}
+	while (1) {
+		seen++;
+		const char *q = rfind(prog, from, p - from + plen - 1, len);
+		if (!q || q + plen <= p) {	// p is clean
+			if (seen >= want || !q) {
+				size_t g = p - from;
+				long m = fwdcount(prog, from, g, len);
+				if (m >= need || !q) {
+					*start = g;
+					if (m >= need) *skip = m - need;
+					else *skip = (prog->edcount < need) ? m : 0;
+					return HX_OK;
+				}
+				want = 2 * seen;
+			}
+		}
+		p = q;
+	}
+} // hx_tail()
+
+static const char *ffind(const hx_program *px, const char *from,
+							size_t pos, size_t len, const char *hist,
+							size_t hlen)
+{	/* The first match at or after pos lying wholly before len. With ??
+	 * in the find string the longest run of bytes without one is found
+	 * first, and the rest checked around it. The hlen bytes at hist come
+	 * just before from, for a lookbehind, and lookahead past len is taken
+	 * to be past the end of the input.
+	*/
+	size_t flen = px->flen, aoff = px->aoff, alen = px->alen;
+	int ctx = (px->behind || px->ahead);
+	int check = (px->maskoff || px->foldoff);	// more than memmem() says
+	while (pos + flen <= len) {
+		const char *s = from + pos;
+		if (px->foldoff) {
+			if (alen) s = cfind(px, s, from + len);
+			if (!s) return NULL;
+		} else if (!px->maskoff) {
+			s = memmem(s, len - pos, TOFIND(px), flen);
+			if (!s) return NULL;
+		} else if (alen) {
+			const char *p = memmem(s + aoff, len - pos - flen + alen,
+									TOFIND(px) + aoff, alen);
+			if (!p) return NULL;
+			s = p - aoff;
+		}
+		if ((!check || prefixof(px, s, flen)) &&
+			(!ctx || ctxok(px, from, len, s, hist, hlen))) return s;
+		pos = s - from + 1;
+	}
+	return NULL;
+} // ffind()
+
+static const char *rfind(const hx_program *px, const char *from,
+							size_t end, size_t len)
+{	/* The last match lying wholly before end, in an input of len bytes.
+	 * memrchr() finds candidates for the last byte of the run searched
+	 * for a vector at a time, unless (?i) lets it be either case.
+	*/
+	size_t flen = px->flen, aoff = px->aoff, alen = px->alen;
+	int ctx = (px->behind || px->ahead);
+	if (flen > end) return NULL;
+	if (!alen) {	// every byte is ??
+		const char *s = from + end - flen;
+		while (ctx && !ctxok(px, from, len, s, NULL, 0)) {
+			if (s == from) return NULL;
+			s--;
+		}
+		return s;
+	}
+	const char *a = TOFIND(px) + aoff;
+	size_t lo = aoff + alen - 1;	// look for its last byte in [lo, hi)
+	size_t hi = end - flen + lo + 1;
+	char fo = (px->foldoff) ? FOLD(px)[lo] : 0;
+	while (hi > lo) {
+		const char *p = from + hi;
+		if (!fo) {
+			p = memrchr(from + lo, a[alen - 1], hi - lo);
+		} else {
+			while (p > from + lo && (p[-1] | fo) != a[alen - 1]) p--;
+			p = (p > from + lo) ? p - 1 : NULL;
+		}
+		if (!p) return NULL;
+		const char *s = p - lo;
+		int ok = (px->foldoff) ? prefixof(px, s, flen) :
+					memcmp(s + aoff, a, alen - 1) == 0 &&
+					(!px->maskoff || prefixof(px, s, flen));
+		if (ok && (!ctx || ctxok(px, from, len, s, NULL, 0))) return s;
+		hi = p - from;
+	}
+	return NULL;
+} // rfind()
+
+static int ctxok(const hx_program *px, const char *from, size_t len,
+					const char *found, const char *hist, size_t hlen)
+{	/* Does the match at found stand where its lookbehind and lookahead
+	 * say it may. The lookbehind may reach back into hist, before the
+	 * start of the input it fails, as does a lookahead past its end.
+	*/
+	int fold = (px->foldoff != 0);
+	if (px->behind) {
+		size_t n = px->behind, have = found - from;
+		const char *b = BEHIND(px), *m = b + n;
+		int ok;
+		if (have >= n) {
+			ok = masked(b, m, found - n, n, fold);
+		} else if (have + hlen >= n) {	// partly from before from
+			size_t h = n - have;
+			ok = masked(b, m, hist + hlen - h, h, fold) &&
+					masked(b + h, m + h, from, have, fold);
+		} else {
+			ok = 0;
+		}
+		if (ok == px->bneg) return 0;
+	}
+	if (px->ahead) {
+		size_t n = px->ahead, at = found - from + px->flen;
+		const char *a = AHEAD(px);
+		int ok = (len - at >= n) && masked(a, a + n, from + at, n, fold);
+		if (ok == px->aneg) return 0;
+	}
+	return 1;
+} // ctxok()
+
+static int masked(const char *ctx, const char *mask, const char *p,
+					size_t n, int fold)
+{	/* n bytes of p are as ctx says, where mask is 0 anything goes. With
+	 * fold a letter, lower case in ctx, may be either case in p.
+	*/
+	size_t i;
+	for (i = 0; i < n; i++) {
+		char fo = (fold && ctx[i] >= 'a' && ctx[i] <= 'z') ? 0x20 : 0;
+		if (mask[i] && (p[i] | fo) != ctx[i]) return 0;
+	}
+	return 1;
+} // masked()
+
+static void remember(hx_stream *st, const char *from, size_t len)
+{	/* Keep the last of the input scanned so far, as much as the
+	 * lookbehind needs, from NULL being len bytes of 0x00.
+	*/
+	size_t n = st->prog->behind;
+	if (!n || !len) return;
+	if (len >= n) {
+		if (from) memcpy(st->hist, from + len - n, n);
+		else memset(st->hist, 0, n);
+		st->hlen = n;
+		return;
+	}
+	size_t k = (st->hlen < n - len) ? st->hlen : n - len;
+	memmove(st->hist, st->hist + st->hlen - k, k);
+	if (from) memcpy(st->hist + k, from, len);
+	else memset(st->hist + k, 0, len);
+	st->hlen = k + len;
+} // remember()
+
+static int prefixof(const hx_program *px, const char *p, size_t n)
+{	/* could the n bytes at p begin a match, all of one if n is flen */
+	const char *f = TOFIND(px);
+	if (px->foldoff)
+		return foldeq(f, FOLD(px), px->maskoff ? MASK(px) : NULL, p, n);
+	if (!px->maskoff) return memcmp(p, f, n) == 0;
+	const char *m = MASK(px);
+	size_t i;
+	for (i = 0; i < n; i++) {
+		if (m[i] && p[i] != f[i]) return 0;
+	}
+	return 1;
+} // prefixof()
+
+static int foldeq(const char *f, const char *fold, const char *mask,
+					const char *p, size_t n)
+{	/* n bytes of p are f, where fold is 0x20 a letter of either case and
+	 * where mask, if any, is 0 any byte at all. OR-ing fold into p turns
+	 * the letters lower case, as f has them, 16 lanes at a time.
+	*/
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		v16 a, b, c, m;
+		memcpy(&a, p + i, 16);
+		memcpy(&b, f + i, 16);
+		memcpy(&c, fold + i, 16);
+		v16 d = (a | c) ^ b;
+		if (mask) {
+			memcpy(&m, mask + i, 16);
+			d &= -m;	// 1 becomes 0xFF
+		}
+		uint64_t w[2];
+		memcpy(w, &d, 16);
+		if (w[0] | w[1]) return 0;
+	}
+	for (; i < n; i++) {
+		if ((!mask || mask[i]) && (p[i] | fold[i]) != f[i]) return 0;
+	}
+	return 1;
+} // foldeq()
+
+static const char *cfind(const hx_program *px, const char *s,
+							const char *end)
+{	/* The first place at or after s, for a match lying wholly before
+	 * end, where the first and last bytes of the run searched for are,
+	 * in either case where (?i) lets them be. 16 places are tried at once
+	 * with fold OR-ed in, no copy of the input is made lower case.
+	*/
+	const char *f = TOFIND(px), *fo = FOLD(px);
+	size_t i1 = px->aoff, i2 = px->aoff + px->alen - 1;
+	if ((size_t)(end - s) < px->flen) return NULL;
+	const char *last = end - px->flen;	// the last place a match can be
+	v16 b1, o1, b2, o2;
+	memset(&b1, f[i1], 16);
+	memset(&o1, fo[i1], 16);
+	memset(&b2, f[i2], 16);
+	memset(&o2, fo[i2], 16);
+	for (; last - s >= 16; s += 16) {
+		v16 x, y;
+		memcpy(&x, s + i1, 16);
+		memcpy(&y, s + i2, 16);
+		v16 hit = (v16)(((x | o1) == b1) & ((y | o2) == b2));
+		uint64_t w[2];
+		memcpy(w, &hit, 16);
+		if (!(w[0] | w[1])) continue;
+		int k;
+		for (k = 0; k < 16; k++) {
+			if (hit[k]) return s + k;
+		}
+	}
+	for (; s <= last; s++) {
+		if ((s[i1] | fo[i1]) == f[i1] && (s[i2] | fo[i2]) == f[i2])
+			return s;
+	}
+	return NULL;
+} // cfind()
+
+static long fwdcount(const hx_program *px, const char *from, size_t pos,
+						size_t len)
+{	/* the matches a forward scan of from makes, starting at pos */
+	long n = 0;
+	while (pos < len) {
+		const char *p = ffind(px, from, pos, len, NULL, 0);
+		if (!p) break;
+		n++;
+		pos = p - from + px->flen;
+	}
+	return n;
+} // fwdcount()
+
+static int emitsegs(hx_stream *st, const char *found)
+{	/* a replacement with \N in it, straight from the match and the image */
+	const hx_program *px = st->prog;
+	const hxp_seg *sg = SEGS(px);
+	size_t i;
+	for (i = 0; i < px->nseg; i++) {
+		const char *p = sg[i].cap ? found : TOREPLACE(px);
+		EMIT(st, p + sg[i].off, sg[i].len);
+	}
+	return HX_OK;
+} // emitsegs()
+
+static const unsigned char u8len[16] = {	// by the top 4 bits of a lead
+	1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 2, 2, 3, 4	// byte, 0 if it isn't
+};
+static const uint32_t u8min[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+
+static const char *nfind(const char *from, size_t pos, size_t len,
+							size_t *mlen)
+{	/* The next thing op n changes, U+0085 NEL, U+00A0 NBSP, U+200B ZWSP,
+	 * U+2028 LS, U+2029 PS or U+FEFF BOM. ASCII is passed over 64 bytes
+	 * at a time, only around a byte with its top bit set is the UTF-8
+	 * decoded. A sequence cut short by len is not one.
+	*/
+	const unsigned char *p = (const unsigned char *)from + pos;
+	const unsigned char *end = (const unsigned char *)from + len;
+	while (p < end) {
+		while (end - p >= 64) {
+			v16 v[4];
+			memcpy(v, p, 64);
+			v16 any = v[0] | v[1] | v[2] | v[3];
+			uint64_t w[2];
+			memcpy(w, &any, 16);
+			if ((w[0] | w[1]) & 0x8080808080808080ULL) break;
+			p += 64;
+		}
+		while (p < end && *p < 0x80) p++;
+		if (p == end) break;
+		size_t n = u8len[*p >> 4], i;
+		if (!n || (size_t)(end - p) < n) {	// not UTF-8, or cut short
+			p++;
+			continue;
+		}
+		uint32_t c = *p & (0x7f >> n);
+		for (i = 1; i < n && (p[i] & 0xc0) == 0x80; i++) {
+			c = (c << 6) | (p[i] & 0x3f);
+		}
+		if (i < n || c < u8min[n]) {	// broken or overlong
+			p++;
+			continue;
+		}
+		switch (c)
+		{
+			case 0x85: case 0xa0: case 0x200b:
+			case 0x2028: case 0x2029: case 0xfeff:
+				*mlen = n;
+				return (const char *)p;
+		} // switch()
+		p += n;
+	}
+	return NULL;
+} // nfind()
+
+static int nspace(const char *found, size_t mlen, const char *end)
+{	/* Non zero if op n puts a space where found was. NBSP is a space, a
+	 * line or paragraph separator or NEL too unless the line ends there
+	 * anyway. ZWSP and BOM just go.
+	*/
+	const unsigned char *p = (const unsigned char *)found;
+	if (mlen == 2 && p[1] == 0xa0) return 1;
+	if (p[0] == 0xef || (mlen == 3 && p[2] == 0x8b)) return 0;
+	return !(found + mlen < end &&
+				(found[mlen] == '\n' || found[mlen] == '\r'));
+} // nspace()
+
+static int textforms(const char *text, const char *encs, arena *ar,
+						pattern *pt, dtrie *dt)
+{	/* The bytes text, which is UTF-8, comes to in each encoding of encs,
+	 * a comma list of utf8, utf16le and utf16be, NULL for all three, any
+	 * of them with :i after it to match either case of an ASCII letter.
+	 * Each form goes into pt for hx_encoding() and every spelling of it
+	 * into dt. A folded form is all 2^letters of its spellings, the dict
+	 * then matches it exactly in its own encoding with nothing to undo.
+	*/
+	if (!encs) encs = "utf8,utf16le,utf16be";
+	size_t tlen = strlen(text);
+	if (!tlen) return HX_EZEROFIND;
+	uint32_t *cps = ar_alloc(ar, tlen * sizeof(uint32_t));
+	char *list = ar_strdup(ar, encs);
+	size_t nenc = 1, i;
+	for (i = 0; encs[i]; i++) nenc += (encs[i] == ',');
+	pt->form = ar_alloc(ar, nenc * sizeof(hxp_form));
+	pt->fbytes = ar_alloc(ar, nenc * tlen * 4);
+	size_t *lpos = ar_alloc(ar, tlen * sizeof(size_t));
+	if (!cps || !list || !pt->form || !pt->fbytes || !lpos)
+		return HX_ENOMEM;
+	// the code points, strictly, no overlong forms or surrogates
+	const unsigned char *p = (const unsigned char *)text;
+	const unsigned char *end = p + tlen;
+	size_t ncp = 0;
+	while (p < end) {
+		size_t n = u8len[*p >> 4];
+		if (!n || (size_t)(end - p) < n) return HX_EFORM;
+		uint32_t c = (n == 1) ? *p : *p & (0x7f >> n);
+		for (i = 1; i < n; i++) {
+			if ((p[i] & 0xc0) != 0x80) return HX_EFORM;
+			c = (c << 6) | (p[i] & 0x3f);
+		}
+		if (c < u8min[n] || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+			return HX_EFORM;
+		cps[ncp++] = c;
+		p += n;
+	}
+	// each form, and how many spellings all of them come to
+	size_t total = 0, nspell = 0;
+	char *sp, *tok;
+	for (tok = strtok_r(list, ",", &sp); tok; tok = strtok_r(NULL, ",", &sp)) {
+		hxp_form *fm = &pt->form[pt->nform];
+		char *fold = strchr(tok, ':');
+		fm->fold = 0;
+		if (fold) {
+			if (strcmp(fold, ":i")) return HX_EFORM;
+			*fold = 0;
+			fm->fold = 1;
+		}
+		for (fm->enc = 0; fm->enc < HXT_NENC; fm->enc++) {
+			if (!strcmp(tok, encname[fm->enc])) break;
+		}
+		if (fm->enc == HXT_NENC) return HX_EFORM;
+		fm->off = pt->fblen;
+		unsigned char *to = (unsigned char *)pt->fbytes + pt->fblen;
+		size_t nl = 0;
+		for (i = 0; i < ncp; i++) {
+			if (cps[i] < 0x80 && isalpha(cps[i])) nl++;
+			to += encode(cps[i], fm->enc, to);
+		}
+		fm->len = to - (unsigned char *)pt->fbytes - pt->fblen;
+		if (fm->fold && nl > HXT_MAXFOLD) return HX_EFORM;
+		size_t n = (fm->fold) ? (size_t)1 << nl : 1;
+		nspell += n;
+		total += n * fm->len;
+		pt->fblen += fm->len;
+		pt->nform++;
+	}
+	if (!pt->nform) return HX_EFORM;
+	unsigned char *bytes = malloc(total);
+	uint32_t *lens = malloc(nspell * sizeof(uint32_t));
+	if (!bytes || !lens) {
+		free(bytes);
+		free(lens);
+		return HX_ENOMEM;
+	}
+	unsigned char *to = bytes;
+	uint32_t *lp = lens;
+	size_t f;
+	for (f = 0; f < pt->nform; f++) {
+		const hxp_form *fm = &pt->form[f];
+		const unsigned char *src = (unsigned char *)pt->fbytes + fm->off;
+		size_t nl = 0, at = 0, v, j;
+		unsigned char tmp[4];
+		for (i = 0; fm->fold && i < ncp; i++) {
+			if (cps[i] < 0x80 && isalpha(cps[i]))
+				lpos[nl++] = at + (fm->enc == HXT_UTF16BE);
+			at += encode(cps[i], fm->enc, tmp);
+		}
+		for (v = 0; v < ((size_t)1 << nl); v++) {	// bit j is letter j's case
+			memcpy(to, src, fm->len);
+			for (j = 0; j < nl; j++) {
+				to[lpos[j]] = (v >> j & 1) ? toupper(src[lpos[j]])
+											: tolower(src[lpos[j]]);
+			}
+			to += fm->len;
+			*lp++ = fm->len;
+		}
+	}
+	int res = dt_build_mem(bytes, lens, nspell, dt);
+	free(bytes);
+	free(lens);
+	return res;
+} // textforms()
+
+static size_t encode(uint32_t c, int enc, unsigned char *to)
+{	/* c in enc at to, a code point over U+FFFF as a surrogate pair in
+	 * UTF-16. Returns how many bytes that is.
+	*/
+	if (enc == HXT_UTF8) {
+		if (c < 0x80) {
+			to[0] = c;
+			return 1;
+		} else if (c < 0x800) {
+			to[0] = 0xc0 | (c >> 6);
+			to[1] = 0x80 | (c & 0x3f);
+			return 2;
+		} else if (c < 0x10000) {
+			to[0] = 0xe0 | (c >> 12);
+			to[1] = 0x80 | ((c >> 6) & 0x3f);
+			to[2] = 0x80 | (c & 0x3f);
+			return 3;
+		}
+		to[0] = 0xf0 | (c >> 18);
+		to[1] = 0x80 | ((c >> 12) & 0x3f);
+		to[2] = 0x80 | ((c >> 6) & 0x3f);
+		to[3] = 0x80 | (c & 0x3f);
+		return 4;
+	}
+	size_t n = 0, i;
+	uint16_t unit[2];
+	if (c < 0x10000) {
+		unit[n++] = c;
+	} else {
+		unit[n++] = 0xd800 + ((c - 0x10000) >> 10);
+		unit[n++] = 0xdc00 + ((c - 0x10000) & 0x3ff);
+	}
+	for (i = 0; i < n; i++) {
+		to[2 * i + (enc == HXT_UTF16LE)] = unit[i] >> 8;
+		to[2 * i + (enc != HXT_UTF16LE)] = unit[i] & 0xff;
+	}
+	return 2 * n;
+} // encode()
+
+static int samefold(const char *a, const char *b, size_t len, int enc)
+{	/* a and b, both in enc, differ only in the case of ASCII letters. In
+	 * UTF-16 a letter is the low byte of a unit whose high byte is 0x00.
+	*/
+	size_t i;
+	for (i = 0; i < len; i++) {
+		if (a[i] == b[i]) continue;
+		if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+			return 0;
+		if (enc == HXT_UTF16LE && (i & 1 || a[i + 1])) return 0;
+		if (enc == HXT_UTF16BE && (!(i & 1) || a[i - 1])) return 0;
+	}
+	return 1;
+} // samefold()
+
+int hx_exec_part(const hx_program *prog, const char *from, size_t len,
+					size_t limit, hx_sink sink, void *ctx, long *count,
+					size_t *used)
+{
+	hx_stream *st;
+	if (prog->skip) return HX_ECOUNT;	// the state would need the skips
+	if (prog->behind) return HX_ECONTEXT;
+	int res = hx_stream_new(prog, sink, ctx, &st);
+	if (res) return res;
+	st->fcount = *count;
+	res = scan(st, from, len, limit, used);
+	*count = st->fcount;
+	hx_stream_free(st);
+	return res;
+} // hx_exec_part()
+
+size_t hx_maxlen(const hx_program *prog)
+{
+	return prog->maxlen;
+} // hx_maxlen()
+
+size_t hx_minlen(const hx_program *prog)
+{
+	return prog->minlen;
+} // hx_minlen()
+
+long hx_edcount(const hx_program *prog)
+{
+	return prog->edcount;
+} // hx_edcount()
+
+long hx_skip(const hx_program *prog)
+{
+	return prog->skip;
+} // hx_skip()
+
+long hx_fromend(const hx_program *prog)
+{
+	return prog->fromend;
+} // hx_fromend()
+
+const void *hx_image(const hx_program *prog, size_t *size)
+{
+	*size = prog->size;
+	return prog;
+} // hx_image()
+
+const char *hx_replacement(const hx_program *prog, size_t *len)
+{
+	*len = prog->outlen;
+	return prog->nseg ? NULL : TOREPLACE(prog);
+} // hx_replacement()
+
+size_t hx_expand(const hx_program *prog, const char *found, char *to)
+{
+	if (!prog->nseg) {
+		memcpy(to, TOREPLACE(prog), prog->rlen);
+		return prog->rlen;
+	}
+	const hxp_seg *sg = SEGS(prog);
+	size_t i, n = 0;
+	for (i = 0; i < prog->nseg; i++) {
+		const char *p = sg[i].cap ? found : TOREPLACE(prog);
+		memcpy(to + n, p + sg[i].off, sg[i].len);
+		n += sg[i].len;
+	}
+	return n;
+} // hx_expand()
+
+int hx_exec_fd(const hx_program *prog, int ifd, int ofd, long *count)
+{	/* Edit ifd to ofd. A regular file is mapped and written straight
+	 * from the mapping, anything else is read() to end of file.
+	*/
+	hx_stream *st;
+	struct stat sb;
+	if (fstat(ifd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+		char *map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, ifd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, sb.st_size, MADV_SEQUENTIAL);
+			int res = hx_exec(prog, map, sb.st_size, fdsink, &ofd, count);
+			munmap(map, sb.st_size);
+			return (res == HX_ESINK) ? HX_EIO : res;
+		}
+	}
+	const size_t bufsize = 256 * 1024;
+	char *buf = malloc(bufsize);
+	if (!buf) return HX_ENOMEM;
+	int res = hx_stream_new(prog, fdsink, &ofd, &st);
+	while (res == HX_OK) {
+		ssize_t n = read(ifd, buf, bufsize);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) res = HX_EIO;
+		if (n <= 0) break;
+		res = hx_feed(st, buf, n);
+	}
+	if (res == HX_OK) res = hx_flush(st);
+	if (res == HX_ESINK) res = HX_EIO;	// only fdsink fails that way
+	if (st && count) *count = st->fcount;
+	hx_stream_free(st);
+	free(buf);
+	return res;
+} // hx_exec_fd()
+
+static int fdsink(void *ctx, const char *from, size_t len)
+{
+	int fd = *(int *)ctx;
+	while (len) {
+		size_t n = len;
+		const char *p = from;
+		if (!from) {	// no holes in general, write out the zeros
+			p = zeros;
+			if (n > ZCHUNK) n = ZCHUNK;
+		}
+		ssize_t res = write(fd, p, n);
+		if (res == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		len -= res;
+		if (from) from += res;
+	}
+	return 0;
+} // fdsink()
+
+static size_t settled(const hx_stream *st, const char *from, size_t len,
+						size_t limit)
+{	/* Everything before limit can be decided now. Of the bytes after it
+	 * only those from the first that could start a match more input might
+	 * complete need holding back, a stream that is followed sees the rest
+	 * of its output without waiting.
+	*/
+	const hx_program *px = st->prog;
+	if (st->fcount >= px->edcount) return len;
+	dview dv;
+	if (px->dict.npat) dt_view((const char *)px, &px->dict, &dv);
+	for (; limit < len; limit++) {
+		size_t avail = len - limit;
+		if (px->op == 'n') {
+			if ((unsigned char)from[limit] >= 0x80) break;
+		} else if (px->dict.npat) {
+			if (dt_partial(&dv, from + limit, avail)) break;
+		} else if (avail < px->flen + px->ahead &&
+					prefixof(px, from + limit,
+								(avail < px->flen) ? avail : px->flen)) {
+			break;	// a match, or a match that can't be told yet
+		}
+	}
+	return limit;
+} // settled()
+
+static int scan(hx_stream *st, const char *from, size_t len,
+				size_t limit, size_t *used)
+{	/* Edit every match that starts before limit, pass everything else
+	 * before limit through unchanged. Sets used to how many bytes of
+	 * from were dealt with, at least limit, more if a match ran past it.
+	*/
+	const hx_program *px = st->prog;
+	size_t pos = 0, mlen = px->flen;
+	dview dv;
+	if (px->dict.npat) dt_view((const char *)px, &px->dict, &dv);
+	if (st->fcount >= px->edcount) limit = len;	// nothing to find
+	while (pos < limit) {
+		const char *found = NULL;
+		if (st->fcount >= px->edcount) {
+			// done
+		} else if (px->op == 'n') {
+			found = nfind(from, pos, len, &mlen);
+		} else if (px->dict.npat) {
+			found = dt_next(&dv, from, pos, limit, len, &mlen);
+		} else {
+			found = ffind(px, from, pos, len, st->hist, st->hlen);
+		}
+		if (!found || (size_t)(found - from) >= limit) {
+			EMIT(st, from + pos, limit - pos);
+			pos = limit;
+			break;
+		}
+		if (st->skip) {	// =@N, not this one yet
+			st->skip--;
+			EMIT(st, from + pos, found + mlen - (from + pos));
+			pos = found + mlen - from;
+			continue;
+		}
+		st->fcount++;
+		if (st->match && st->match(st->mctx, st->done + (found - from),
+									found, mlen)) return HX_ESINK;
+		// the file content up to the find string
+		EMIT(st, from + pos, found - (from + pos));
+		switch (px->op)
+		{
+			case 'a':	// append to find string
+				EMIT(st, found, mlen);
+				EMITREP(st, px, found);
+				break;
+			case 'i':	// insert before find string
+				EMITREP(st, px, found);
+				EMIT(st, found, mlen);
+				break;
+			case 'd':	// delete find string
+				// do nothing
+				break;
+			case 's':	// substitute find string.
+				EMITREP(st, px, found);
+				break;
+			case 'b':	// split before or after, the output is
+			case 'e':	// unchanged, hx_match tells where
+				EMIT(st, found, mlen);
+				break;
+			case 'n':	// a space or nothing
+				if (nspace(found, mlen, from + len)) EMIT(st, " ", 1);
+				break;
+		} // switch()
+		pos = found + mlen - from;
+	} // while()
+	*used = pos;
+	st->done += pos;
+	remember(st, from, pos);
+	return HX_OK;
+} // scan()
+
+static int parsectx(char *hex, arena *ar, pattern *pt, char **core)
+{	/* Take a (?<=...) or (?<!...) off the front of hex and a (?=...) or
+	 * (?!...) off the end, leaving the find string proper in core.
+	*/
+	char *cp = hex;
+	if (strncmp(cp, "(?<=", 4) == 0 || strncmp(cp, "(?<!", 4) == 0) {
+		char *ep = strchr(cp, ')');
+		if (!ep) return HX_EFORM;
+		pt->neg[0] = (cp[3] == '!');
+		int res = ctxbytes(cp + 4, ep - (cp + 4), ar, pt, 0);
+		if (res) return res;
+		cp = ep + 1;
+	}
+	char *ap = strstr(cp, "(?=");	// (?? is a group starting with ??
+	char *np = strstr(cp, "(?!");
+	if (!ap || (np && np < ap)) ap = np;
+	if (ap) {
+		size_t n = strlen(ap);
+		if (ap[n - 1] != ')' || strchr(ap, ')') != ap + n - 1)
+			return HX_EFORM;
+		pt->neg[1] = (ap[2] == '!');
+		int res = ctxbytes(ap + 3, n - 4, ar, pt, 1);
+		if (res) return res;
+		*ap = '\0';
+	}
+	*core = cp;
+	return HX_OK;
+} // parsectx()
+
+static int ctxbytes(const char *hex, size_t len, arena *ar, pattern *pt,
+					int which)
+{	/* hex pairs and ?? into pt->ctx[which], the bytes then their mask */
+	if (!len) return HX_EFORM;
+	char *p = ar_alloc(ar, 2 * len);	// the mask at first after len
+	if (!p) return HX_ENOMEM;
+	const char *cp = hex, *end = hex + len;
+	size_t n = 0;
+	while (cp < end) {
+		if (*cp == '?') {
+			if (cp + 1 == end || cp[1] != '?') return HX_EPAIR;
+			p[n] = 0;
+			p[len + n++] = 0;
+			cp += 2;
+			continue;
+		}
+		size_t used;
+		int k = literal(cp, p + n, &used);
+		if (k < 0) return k;
+		if (cp + used > end) return HX_EFORM;
+		memset(p + len + n, 1, k);
+		n += k;
+		cp += used;
+	}
+	memmove(p + n, p + len, n);
+	pt->ctx[which] = p;
+	pt->clen[which] = n;
+	return HX_OK;
+} // ctxbytes()
+
+static int parsefind(const char *hex, arena *ar, pattern *pt)
+{	/* Hex pairs where ?? matches any byte and ( ) make a group that \N
+	 * in the replacement can use, numbered by their ( from 1.
+	*/
+	size_t len = strlen(hex);
+	pt->find = ar_alloc(ar, len / 2 + 1);
+	pt->mask = ar_alloc(ar, len / 2 + 1);
+	if (!pt->find || !pt->mask) return HX_ENOMEM;
+	int open[HXP_MAXGROUP + 1], depth = 0, wild = 0;
+	size_t n = 0;
+	const char *cp = hex;
+	while (*cp) {
+		if (*cp == '(') {
+			if (cp[1] == '?' && cp[2] != '?') return HX_EFORM;	// (?<= etc
+			if (pt->ngroup == HXP_MAXGROUP) return HX_EFORM;
+			pt->ngroup++;
+			pt->gpos[pt->ngroup] = n;
+			open[depth++] = pt->ngroup;
+			cp++;
+		} else if (*cp == ')') {
+			if (!depth) return HX_EFORM;
+			int g = open[--depth];
+			pt->glen[g] = n - pt->gpos[g];
+			cp++;
+		} else if (*cp == '?') {
+			if (cp[1] != '?') return HX_EPAIR;
+			pt->find[n] = 0;
+			pt->mask[n++] = 0;
+			wild = 1;
+			cp += 2;
+		} else {
+			size_t used;
+			int k = literal(cp, &pt->find[n], &used);
+			if (k < 0) return k;
+			memset(&pt->mask[n], 1, k);
+			n += k;
+			cp += used;
+		}
+	}
+	if (depth) return HX_EFORM;
+	pt->flen = n;
+	pt->glen[0] = n;	// \0
+	if (!wild) pt->mask = NULL;
+	return HX_OK;
+} // parsefind()
+
+static int foldcase(arena *ar, pattern *pt)
+{	/* (?i): the ASCII letters of the find string and of its lookbehind
+	 * and lookahead go lower case, and each letter of the find string gets
+	 * 0x20 in fold, which OR-ed into an input byte lets either case match.
+	 * With no letters anywhere there is nothing to fold.
+	*/
+	char *fold = ar_alloc(ar, pt->flen);
+	if (!fold) return HX_ENOMEM;
+	size_t i, nl = 0;
+	int w;
+	for (i = 0; i < pt->flen; i++) {
+		char lc = pt->find[i] | 0x20;
+		fold[i] = 0;
+		if ((!pt->mask || pt->mask[i]) && lc >= 'a' && lc <= 'z') {
+			pt->find[i] = lc;
+			fold[i] = 0x20;
+			nl++;
+		}
+	}
+	for (w = 0; w < 2; w++) {
+		char *b = pt->ctx[w], *m = b + pt->clen[w];
+		for (i = 0; i < pt->clen[w]; i++) {
+			char lc = b[i] | 0x20;
+			if (m[i] && lc >= 'a' && lc <= 'z') {
+				b[i] = lc;
+				nl++;
+			}
+		}
+	}
+	if (nl) pt->fold = fold;
+	return HX_OK;
+} // foldcase()
+
+static int parserep(const char *hex, arena *ar, pattern *pt)
+{	/* Hex pairs where \N puts in what group N matched, \0 the whole
+	 * match. Without any \N the replacement is used just as it is,
+	 * otherwise it is kept as pieces of itself and of the match.
+	*/
+	size_t len = strlen(hex);
+	pt->rep = ar_alloc(ar, len / 2 + 1);
+	pt->seg = ar_alloc(ar, (len + 1) * sizeof(hxp_seg));
+	if (!pt->rep || !pt->seg) return HX_ENOMEM;
+	size_t n = 0, ns = 0;
+	int cap = 0;
+	const char *cp = hex;
+	while (*cp) {
+		if (*cp == '\\') {
+			if (!isdigit(cp[1]) || cp[1] - '0' > pt->ngroup) return HX_EFORM;
+			int g = cp[1] - '0';
+			cp += 2;
+			if (!pt->glen[g]) continue;	// an empty group
+			hxp_seg *sg = &pt->seg[ns++];
+			sg->cap = 1;
+			sg->off = pt->gpos[g];
+			sg->len = pt->glen[g];
+			cap = 1;
+		} else {
+			size_t used;
+			int k = literal(cp, &pt->rep[n], &used);
+			if (k < 0) return k;
+			cp += used;
+			if (ns && !pt->seg[ns - 1].cap) {	// carries on the last piece
+				pt->seg[ns - 1].len += k;
+			} else {
+				hxp_seg *sg = &pt->seg[ns++];
+				sg->cap = 0;
+				sg->off = n;
+				sg->len = k;
+			}
+			n += k;
+		}
+	}
+	pt->rlen = n;
+	pt->nseg = (cap) ? ns : 0;
+	size_t i;
+	for (i = 0; i < ns; i++) pt->outlen += pt->seg[i].len;
+	return HX_OK;
+} // parserep()
+
+static int hexpair(const char *cp, char *byte)
+{
+	const char *validhex = "0123456789abcdefABCDEF";
+	if (!cp[1] || strchr("()?\\", cp[1])) return HX_EPAIR;
+	if (!strchr(validhex, cp[0]) || !strchr(validhex, cp[1])) return HX_EHEX;
+	char wrk[3] = { cp[0], cp[1], 0 };
+	*byte = strtol(wrk, NULL, 16);
+	return HX_OK;
+} // hexpair()
+
+static int literal(const char *cp, char *to, size_t *used)
+{	/* A hex pair, or a code point, U+XXXX or U+{X} to U+{XXXXXX}, as
+	 * its UTF-8. Returns how many bytes went to to, or an HX_E* code.
+	*/
+	if (cp[0] != 'U' || cp[1] != '+') {
+		*used = 2;
+		int res = hexpair(cp, to);
+		return (res) ? res : 1;
+	}
+	const char *hp = cp + 2;
+	size_t nd = 4, i;
+	*used = 6;
+	if (*hp == '{') {
+		const char *ep = strchr(++hp, '}');
+		if (!ep || ep == hp || ep - hp > 6) return HX_EFORM;
+		nd = ep - hp;
+		*used = ep + 1 - cp;
+	}
+	unsigned long c = 0;
+	for (i = 0; i < nd; i++) {
+		if (!isxdigit((unsigned char)hp[i])) return HX_EHEX;
+		char wrk[2] = { hp[i], 0 };
+		c = c * 16 + strtoul(wrk, NULL, 16);
+	}
+	if (c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) return HX_EHEX;
+	return encode(c, HXT_UTF8, (unsigned char *)to);
+} // literal()
+
+static hx_program *mkimage(int op, long edcount, long skip, long fromend,
+					const pattern *pt, const dtrie *dt)
+{	/* lay the program out as one image, see struct hx_program */
+	size_t dsize = (dt) ? dt_size(dt) : 0;
+	size_t segsize = pt->nseg * sizeof(hxp_seg);
+	size_t flen = pt->flen, rlen = pt->rlen;
+	size_t msize = (pt->mask) ? flen : 0;
+	size_t fsize = (pt->fold) ? flen : 0;
+	size_t csize = 2 * (pt->clen[0] + pt->clen[1]);
+	size_t fmsize = pt->nform * sizeof(hxp_form);	// keeps the dict aligned
+	size_t size = sizeof(hx_program) + segsize + fmsize + dsize + flen
+					+ rlen + msize + fsize + csize + pt->fblen;
+	hx_program *px = mmap(NULL, size, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (px == MAP_FAILED) return NULL;
+	px->magic = HXP_MAGIC;
+	px->version = HXP_VERSION;
+	px->size = size;
+	px->edcount = edcount;
+	px->skip = skip;
+	px->fromend = fromend;
+	px->flen = flen;
+	px->rlen = rlen;
+	px->segoff = sizeof(hx_program);
+	px->nseg = pt->nseg;
+	px->outlen = pt->outlen;
+	px->formoff = px->segoff + segsize;
+	px->nform = pt->nform;
+	px->findoff = px->formoff + fmsize + dsize;
+	px->repoff = px->findoff + flen;
+	px->op = op;
+	char *image = (char *)px;
+	if (segsize) memcpy(image + px->segoff, pt->seg, segsize);
+	memcpy(image + px->findoff, pt->find, flen);
+	if (rlen) memcpy(image + px->repoff, pt->rep, rlen);
+	px->alen = flen;	// all of it unless there's a ??
+	if (msize) {
+		px->maskoff = px->repoff + rlen;
+		memcpy(image + px->maskoff, pt->mask, flen);
+		size_t i, run = 0;
+		px->alen = 0;
+		for (i = 0; i < flen; i++) {
+			run = (pt->mask[i]) ? run + 1 : 0;
+			if (run > px->alen) {
+				px->alen = run;
+				px->aoff = i + 1 - run;
+			}
+		}
+	}
+	if (fsize) {
+		px->foldoff = px->repoff + rlen + msize;
+		memcpy(image + px->foldoff, pt->fold, flen);
+	}
+	px->ctxoff = px->repoff + rlen + msize + fsize;
+	px->behind = pt->clen[0];
+	px->ahead = pt->clen[1];
+	px->bneg = pt->neg[0];
+	px->aneg = pt->neg[1];
+	if (px->behind) memcpy(image + px->ctxoff, pt->ctx[0], 2 * px->behind);
+	if (px->ahead) memcpy(image + px->ctxoff + 2 * px->behind, pt->ctx[1],
+							2 * px->ahead);
+	if (pt->nform) {
+		size_t fboff = px->ctxoff + csize, i;
+		hxp_form *fm = (hxp_form *)(image + px->formoff);
+		memcpy(fm, pt->form, fmsize);
+		for (i = 0; i < pt->nform; i++) fm[i].off += fboff;
+		memcpy(image + fboff, pt->fbytes, pt->fblen);
+	}
+	if (dt) {
+		dt_place(dt, image, px->formoff + fmsize, &px->dict);
+		px->maxlen = dt->maxlen;
+		px->minlen = dt->minlen;
+		px->allzero = dt->allzero;
+	} else {
+		px->maxlen = px->minlen = flen;
+		px->allzero = 1;	// ?? could be 0x00 too
+		size_t i;
+		for (i = 0; i < flen; i++) {
+			if (pt->find[i]) px->allzero = 0;
+		}
+		if (op == 'n') {	// nothing it changes is 0x00
+			px->maxlen = NORM_MAXLEN;
+			px->minlen = 2;	// NEL or NBSP
+			px->allzero = 0;
+		}
+	}
+	mprotect(px, size, PROT_READ);	// shared between threads from here
+	return px;
+} // mkimage()
+
+static int badimage(const hx_program *px, size_t size)
+{	/* non zero unless px is a whole image this version can run */
+	if (px->magic != HXP_MAGIC || px->version != HXP_VERSION) return 1;
+	if (px->size != size) return 1;
+	if (!px->op || !strchr("dsaiben", px->op)) return 1;
+	if (px->op == 's' && px->outlen == 0) return 1;
+	if (px->edcount < 0 || px->skip < 0 || px->fromend < 0) return 1;
+	if (px->fromend && px->dict.npat) return 1;
+	if (px->op == 'n') {
+		if (px->dict.npat || px->flen || px->maxlen != NORM_MAXLEN ||
+			px->fromend || px->nseg || px->behind || px->ahead) return 1;
+	} else if (px->dict.npat) {
+		if (px->flen || px->maxlen == 0 || dt_check(&px->dict, size))
+			return 1;
+		if (px->minlen == 0 || px->minlen > px->maxlen) return 1;
+		if (px->maskoff || px->nseg) return 1;
+	} else if (px->flen == 0 || px->maxlen != px->flen ||
+				px->minlen != px->flen) {
+		return 1;
+	}
+	if (px->findoff < sizeof(hx_program) || px->findoff > size ||
+		px->flen > size - px->findoff) return 1;
+	if (px->repoff < sizeof(hx_program) || px->repoff > size ||
+		px->rlen > size - px->repoff) return 1;
+	if (px->maskoff && (px->maskoff < sizeof(hx_program) ||
+		px->maskoff > size || px->flen > size - px->maskoff)) return 1;
+	if (px->alen > px->flen || px->aoff > px->flen - px->alen) return 1;
+	if (!px->maskoff && px->alen != px->flen) return 1;
+	if (px->behind || px->ahead) {
+		if (px->dict.npat || (px->bneg & ~1) || (px->aneg & ~1)) return 1;
+		if (px->ctxoff < sizeof(hx_program) || px->ctxoff > size ||
+			px->behind > (size - px->ctxoff) / 2 ||
+			px->ahead > (size - px->ctxoff) / 2 - px->behind) return 1;
+	}
+	if (px->foldoff) {
+		if (px->dict.npat || px->foldoff < sizeof(hx_program) ||
+			px->foldoff > size || px->flen > size - px->foldoff) return 1;
+		const char *fo = FOLD(px);
+		uint64_t i;
+		for (i = 0; i < px->flen; i++) {
+			if (fo[i] & ~0x20) return 1;
+		}
+	}
+	if (px->nform) {
+		if (!px->dict.npat || px->formoff < sizeof(hx_program) ||
+			px->formoff > size ||
+			px->nform > (size - px->formoff) / sizeof(hxp_form)) return 1;
+		const hxp_form *fm = FORMS(px);
+		uint64_t i;
+		for (i = 0; i < px->nform; i++) {
+			if (fm[i].enc >= HXT_NENC || fm[i].fold > 1 ||
+				fm[i].off > size || fm[i].len > size - fm[i].off) return 1;
+		}
+	}
+	if (!px->nseg) return px->outlen != px->rlen;
+	if (px->segoff < sizeof(hx_program) || px->segoff > size ||
+		px->nseg > (size - px->segoff) / sizeof(hxp_seg)) return 1;
+	const hxp_seg *sg = SEGS(px);
+	uint64_t i, out = 0;
+	for (i = 0; i < px->nseg; i++) {
+		uint64_t lim = (sg[i].cap) ? px->flen : px->rlen;
+		if (sg[i].cap > 1 || sg[i].off > lim || sg[i].len > lim - sg[i].off)
+			return 1;
+		out += sg[i].len;
+	}
+	return out != px->outlen;
+} // badimage()
@@ -0,0 +1,198 @@
+/*      libhexsed.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* The hexsed edit engine as a library. An expression is compiled once
+ * into an hx_program which may then be run any number of times, from
+ * any number of threads, each run with its own hx_stream. Nothing in
+ * here prints or exits, every failure comes back as an HX_E* code.
+*/
+
+#ifndef _LIBHEXSED_H
+#define _LIBHEXSED_H
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	HX_OK = 0,
+	HX_EFORM = -1,		// badly formed expression
+	HX_EZEROFIND = -2,	// zero length search string
+	HX_EZEROREPL = -3,	// zero length replacement string
+	HX_EPAIR = -4,		// hex not input as pairs
+	HX_EHEX = -5,		// invalid hex chars
+	HX_ENOMEM = -6,
+	HX_EIO = -7,		// read or write failed, see errno
+	HX_ESINK = -8,		// the sink asked to stop
+	HX_EPROTO = -9,		// bad request to hexsed --serve
+	HX_EPROG = -10,		// not a compiled program this version can run
+	HX_ECOUNT = -11,	// =-N needs the whole input, see hx_tail()
+	HX_ECONTEXT = -12,	// a lookbehind needs what came before
+};
+
+typedef struct hx_program hx_program;
+typedef struct hx_stream hx_stream;
+
+/* Output goes to a sink. from == NULL means len bytes of 0x00 that are
+ * a hole in the input and may be left as a hole in the output. Return
+ * non zero to abandon the run, the caller then sees HX_ESINK.
+*/
+typedef int (*hx_sink)(void *ctx, const char *from, size_t len);
+
+/* Told of each match as it is edited, mlen bytes at found, which is at
+ * offset at in the input. Non zero return abandons the run as a sink's
+ * does.
+*/
+typedef int (*hx_match)(void *ctx, off_t at, const char *found,
+						size_t mlen);
+
+const char *hx_strerror(int err);
+
+int hx_compile(const char *expr, hx_program **prog);
+int hx_compile_dict(const char *expr, const char *dictpath,
+					hx_program **prog);
+int hx_compile_text(const char *expr, const char *text,
+					const char *encodings, hx_program **prog);
+void hx_free(hx_program *prog);
+int hx_op(const hx_program *prog);
+// Compile step, see libhexsed.c. In a find string ?? matches any byte
+// and ( ) marks a group, up to 9, which \1 to \9 in the replacement
+// put back, \0 all of the match: /(??)(??)/\2\1/s swaps byte pairs.
+// The find string may start with a lookbehind, (?<=hex) or (?<!hex), and
+// end with a lookahead, (?=hex) or (?!hex), bytes that must, or must not,
+// come just before or after a match without being part of it, so
+// /(?<!0D)0A/0D0A/s turns lone line feeds into CR LF. U+XXXX, or U+{X}
+// to U+{XXXXXX}, may be given in place of hex for a code point's UTF-8.
+// A find string starting (?i) matches ASCII letters in either case, in
+// it and in its lookbehind and lookahead.
+// The op n, //n, has no find string of its own: it turns U+2028, U+2029
+// and NEL into a space, or drops them before a line end, NBSP into a
+// space, and drops ZWSP and BOM.
+// For hx_compile_dict() the find string in expr is left empty, //d or
+// //replace/s etc, and the patterns are read from dictpath, one hex
+// string per line, with no ?? or ( ). hx_compile_text() is the same
+// but searches for text, UTF-8, as it is in each of encodings, a comma
+// list of utf8, utf16le and utf16be, NULL for all three. One of them with
+// :i after it, utf16le:i, also matches ASCII letters in either case. The
+// text may have no more than 16 letters to fold. The ops b and e,
+// /find/b and /find/e, edit nothing: they mark where to split, before
+// or after each match, for whoever is told of the matches.
+
+int hx_save(const hx_program *prog, const char *path);
+int hx_load(const char *path, hx_program **prog);
+/* Write a compiled program to a file, and map one back in ready to run.
+ * A loaded program is freed with hx_free() like any other.
+*/
+
+int hx_stream_new(const hx_program *prog, hx_sink sink, void *ctx,
+					hx_stream **st);
+int hx_feed(hx_stream *st, const char *from, size_t len);
+int hx_feed_zeros(hx_stream *st, off_t len);
+int hx_flush(hx_stream *st);
+long hx_count(const hx_stream *st);
+void hx_stream_free(hx_stream *st);
+void hx_stream_matches(hx_stream *st, hx_match match, void *ctx);
+off_t hx_offset(const hx_stream *st);
+void hx_stream_resume(hx_stream *st, off_t offset, long count);
+void hx_stream_before(hx_stream *st, const char *from, size_t len);
+// Incremental execute step. hx_offset() is where the bytes still held
+// back start, everything before it has gone to the sink. A new stream
+// can be told to carry on from there, with count edits already done,
+// and told the input before there for a lookbehind to see.
+
+int hx_exec(const hx_program *prog, const char *from, size_t len,
+				hx_sink sink, void *ctx, long *count);
+int hx_exec_fd(const hx_program *prog, int ifd, int ofd, long *count);
+// One shot execute over a whole buffer or from one fd to another.
+
+int hx_tail(const hx_program *prog, const char *from, size_t len,
+				size_t *start, long *skip);
+int hx_stream_tail(const hx_program *prog, long skip, hx_sink sink,
+					void *ctx, hx_stream **st);
+/* A count from the end, =-N or =@-N, is found by searching back from the
+ * end of the whole input for where the edits start, so hx_stream_new()
+ * refuses such a program. hx_tail() gives the offset before which the
+ * input is left as it is, usually close to the end, and how many matches
+ * after it to pass over. hx_stream_tail() is then fed from that offset.
+ * hx_exec() does all that itself.
+*/
+
+int hx_exec_part(const hx_program *prog, const char *from, size_t len,
+					size_t limit, hx_sink sink, void *ctx, long *count,
+					size_t *used);
+/* Execute over part of a larger input. Only matches starting before
+ * limit are edited and only bytes before limit are passed through.
+ * *count holds the edits done before this part and is updated, *used
+ * is where the next part must start, limit or past it if a match ran
+ * over. len - limit must cover the longest match and its lookahead,
+ * hx_maxlen() - 1 plus the ahead of hx_context(). A program with a
+ * lookbehind can't be run this way, HX_ECONTEXT.
+*/
+
+int hx_record(hx_stream *st, const char *from, size_t len);
+/* Edit len bytes at from as a whole input of their own, a record, so the
+ * count, and a count from the end, start over for each. Records may follow
+ * one another through the one stream, which for a count from the end must
+ * come from hx_stream_tail(), its skip is not used. hx_count() is then the
+ * edits in the last record.
+*/
+
+size_t hx_maxlen(const hx_program *prog);
+size_t hx_minlen(const hx_program *prog);
+// Longest and shortest possible match, the longest for op n with the byte
+// after. They differ only for hx_compile_dict() or hx_compile_text().
+
+long hx_edcount(const hx_program *prog);
+// The =count limit, LONG_MAX if there is none.
+
+long hx_skip(const hx_program *prog);
+long hx_fromend(const hx_program *prog);
+// Matches passed over first for =@N, and N of =-N or =@-N, else 0.
+
+const void *hx_image(const hx_program *prog, size_t *size);
+// The program as hx_save() writes it.
+
+const char *hx_replacement(const hx_program *prog, size_t *len);
+// The replacement string, NULL when it uses \N. *len is how long it
+// comes out either way.
+
+void hx_context(const hx_program *prog, size_t *behind, size_t *ahead);
+// Lengths of the lookbehind and lookahead, 0 where there is none.
+
+int hx_istext(const hx_program *prog);
+const char *hx_encoding(const hx_program *prog, const char *found,
+						size_t mlen);
+/* Non zero for a program from hx_compile_text(), saved and loaded or
+ * not, and for such a program which encoding the match at found is in,
+ * "utf8", "utf16le" or "utf16be". NULL for any other program.
+*/
+
+size_t hx_expand(const hx_program *prog, const char *found, char *to);
+/* Put the replacement for the match at found together at to, which must
+ * have room for the length hx_replacement() gives, and return that.
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,306 @@
+/*      patch.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* hexsed --emit-patch and --apply-patch. Emitting runs the edit as usual
+ * but keeps only where each match was and what replaces it. Applying
+ * needs no search at all, the patch is checked whole, the bytes it is
+ * to replace are read and checked, then the untouched runs between
+ * edits are copied, shared where the fs can, and the new bytes written
+ * in between.
+*/
+
+#include <stddef.h>
+#include "fileops.h"
+#include "crc.h"
+#include "patch.h"
+
+typedef struct emitter {
+	const char *patchfn;
+	FILE *fp;
+	const hx_program *prog;
+	hxd_head hd;
+	off_t end;	// of what the last edit replaced
+	char *ins;	// what it put there
+	size_t inslen;
+	size_t cap;
+	char *prev;
+	size_t prevlen;
+} emitter;
+
+typedef struct cursor {	// decodes a patch body
+	const unsigned char *p;
+	const unsigned char *end;
+	const unsigned char *ins;
+	uint64_t inslen;
+} cursor;
+
+static int onmatch(void *ctx, off_t at, const char *found, size_t mlen);
+static void putvar(emitter *em, uint64_t v);
+static void putbytes(emitter *em, const void *from, size_t len);
+static int nullsink(void *ctx, const char *from, size_t len);
+static int getvar(cursor *cu, uint64_t *v);
+static int nextedit(cursor *cu, uint64_t *gap, uint64_t *dellen);
+
+void emitpatch(const char *fn, const hx_program *prog, const char *patchfn,
+				int quiet)
+{	/* Input is read as it is, compressed input is not expanded, since
+	 * the patch must apply to the very bytes the edit saw.
+	*/
+	int ifd = (strcmp(fn, "-") == 0) ? 0 : doopen(fn, "r");
+	emitter em = {0};
+	em.patchfn = patchfn;
+	em.fp = dofopen(patchfn, "w");
+	em.prog = prog;
+	em.hd.magic = HXD_MAGIC;
+	em.hd.version = HXD_VERSION;
+	dofwrite(patchfn, &em.hd, sizeof(hxd_head), em.fp);	// a place holder
+	hx_stream *st;
+	int res = hx_stream_new(prog, nullsink, NULL, &st);
+	if (res != HX_OK) {	// a count from the end, or memory
+		fprintf(stderr, "%s\n", hx_strerror(res));
+		exit(EXIT_FAILURE);
+	}
+	hx_stream_matches(st, onmatch, &em);
+	const size_t bufsize = 1024 * 1024;
+	char *buf = domalloc(bufsize, "emitpatch()");
+	while (1) {
+		ssize_t n = read(ifd, buf, bufsize);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) {
+			perror(fn);
+			exit(EXIT_FAILURE);
+		}
+		if (n == 0) break;
+		em.hd.insize += n;
+		hx_feed(st, buf, n);	// nullsink() and onmatch() can't fail
+	}
+	hx_flush(st);
+	em.hd.outsize += em.hd.insize;
+	em.hd.headcrc = crc32c(0, &em.hd, offsetof(hxd_head, headcrc));
+	if (fseek(em.fp, 0, SEEK_SET) == -1) {
+		perror(patchfn);
+		exit(EXIT_FAILURE);
+	}
+	dofwrite(patchfn, &em.hd, sizeof(hxd_head), em.fp);
+	dofclose(em.fp);
+	if (ifd) doclose(ifd);
+	if (!quiet) {
+		char *what = (hx_op(prog) == 'd') ? "deletions" : "substitutions";
+		fprintf(stdout, "Did %li %s.\n", hx_count(st), what);
+	}
+	hx_stream_free(st);
+	free(buf);
+	free(em.ins);
+	free(em.prev);
+} // emitpatch()
+
+void applypatch(const char *patchfn, const char *fn, int quiet)
+{	/* The edited file goes to stdout, as hexsed's output always does. */
+	fdata pd = readfile(patchfn, 0, 1);
+	hxd_head hd;
+	size_t plen = pd.to - pd.from;
+	if (plen < sizeof(hxd_head)) goto corrupt;
+	memcpy(&hd, pd.from, sizeof(hxd_head));
+	if (hd.magic != HXD_MAGIC || hd.version != HXD_VERSION) {
+		fprintf(stderr, "Not a hexsed patch: %s\n", patchfn);
+		exit(EXIT_FAILURE);
+	}
+	if (hd.headcrc != crc32c(0, &hd, offsetof(hxd_head, headcrc)) ||
+		hd.bodylen != plen - sizeof(hxd_head) ||
+		hd.bodycrc != crc32c(0, pd.from + sizeof(hxd_head), hd.bodylen))
+		goto corrupt;
+
+	int ifd = doopen(fn, "r");
+	struct stat sb;
+	if (fstat(ifd, &sb) == -1) {
+		perror(fn);
+		exit(EXIT_FAILURE);
+	}
+	if (!S_ISREG(sb.st_mode) || (uint64_t)sb.st_size != hd.insize) {
+		fprintf(stderr, "%s is for a file of %llu bytes: %s\n", patchfn,
+				(unsigned long long)hd.insize, fn);
+		exit(EXIT_FAILURE);
+	}
+
+	// first see that it fits before writing anything
+	cursor cu;
+	uint64_t gap, dellen, pos = 0, outsize = 0, i;
+	uint32_t crc = 0;
+	char *buf = NULL;
+	size_t cap = 0;
+	cu.p = (const unsigned char *)pd.from + sizeof(hxd_head);
+	cu.end = (const unsigned char *)pd.to;
+	cu.ins = NULL;
+	cu.inslen = 0;
+	for (i = 0; i < hd.nedits; i++) {
+		if (nextedit(&cu, &gap, &dellen)) goto corrupt;
+		if (gap > hd.insize - pos || dellen > hd.insize - pos - gap)
+			goto corrupt;
+		pos += gap;
+		if (dellen > cap) {
+			cap = dellen;
+			free(buf);
+			buf = domalloc(cap, "applypatch()");
+		}
+		if (pread(ifd, buf, dellen, pos) != (ssize_t)dellen) {
+			perror(fn);
+			exit(EXIT_FAILURE);
+		}
+		crc = crc32c(crc, buf, dellen);
+		pos += dellen;
+		outsize += gap + cu.inslen;
+	}
+	outsize += hd.insize - pos;
+	if (cu.p != cu.end || outsize != hd.outsize) goto corrupt;
+	if (crc != hd.oldcrc) {
+		fprintf(stderr, "%s does not apply to %s\n", patchfn, fn);
+		exit(EXIT_FAILURE);
+	}
+
+	cu.p = (const unsigned char *)pd.from + sizeof(hxd_head);
+	cu.ins = NULL;
+	pos = 0;
+	for (i = 0; i < hd.nedits; i++) {
+		nextedit(&cu, &gap, &dellen);
+		copyrange(ifd, pos, 1, gap);
+		writeall(1, cu.ins, cu.inslen);
+		pos += gap + dellen;
+	}
+	copyrange(ifd, pos, 1, hd.insize - pos);
+	doclose(ifd);
+	if (!quiet) {
+		fprintf(stdout, "Applied %llu edits.\n",
+				(unsigned long long)hd.nedits);
+	}
+	free(buf);
+	free(pd.from);
+	return;
+corrupt:
+	fprintf(stderr, "Corrupt patch: %s\n", patchfn);
+	exit(EXIT_FAILURE);
+} // applypatch()
+
+static int onmatch(void *ctx, off_t at, const char *found, size_t mlen)
+{	/* Every edit is recorded as replacing the match, the a and i ops
+	 * put the match back with the replacement, so that what it was can
+	 * be checked before the patch is applied anywhere.
+	*/
+	emitter *em = ctx;
+	size_t rlen;
+	hx_replacement(em->prog, &rlen);
+	int op = hx_op(em->prog);
+	size_t need = mlen + rlen;
+	if (need > em->cap) {
+		em->cap = need;
+		em->ins = realloc(em->ins, need);
+		em->prev = realloc(em->prev, need);
+		if (!em->ins || !em->prev) {
+			fputs("Failed to get memory in onmatch()\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	switch (op)
+	{
+		case 'a':
+			memcpy(em->ins, found, mlen);
+			hx_expand(em->prog, found, em->ins + mlen);
+			em->inslen = need;
+			break;
+		case 'i':
+			hx_expand(em->prog, found, em->ins);
+			memcpy(em->ins + rlen, found, mlen);
+			em->inslen = need;
+			break;
+		case 'd':
+			em->inslen = 0;
+			break;
+		case 's':
+			em->inslen = hx_expand(em->prog, found, em->ins);
+			break;
+	} // switch()
+	int same = (em->hd.nedits && em->inslen == em->prevlen &&
+				memcmp(em->ins, em->prev, em->inslen) == 0);
+	putvar(em, at - em->end);
+	putvar(em, mlen);
+	putvar(em, em->inslen * 2 + same);
+	if (!same) {
+		putbytes(em, em->ins, em->inslen);
+		memcpy(em->prev, em->ins, em->inslen);
+		em->prevlen = em->inslen;
+	}
+	em->hd.oldcrc = crc32c(em->hd.oldcrc, found, mlen);
+	em->hd.outsize += em->inslen;
+	em->hd.outsize -= mlen;	// insize is added on at the end
+	em->hd.nedits++;
+	em->end = at + mlen;
+	return 0;
+} // onmatch()
+
+static void putvar(emitter *em, uint64_t v)
+{
+	unsigned char b[10];
+	size_t n = 0;
+	while (v >= 0x80) {
+		b[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	b[n++] = v;
+	putbytes(em, b, n);
+} // putvar()
+
+static void putbytes(emitter *em, const void *from, size_t len)
+{
+	dofwrite(em->patchfn, from, len, em->fp);
+	em->hd.bodycrc = crc32c(em->hd.bodycrc, from, len);
+	em->hd.bodylen += len;
+} // putbytes()
+
+static int nullsink(void *ctx, const char *from, size_t len)
+{	/* the edited output itself is not wanted */
+	(void)ctx;
+	(void)from;
+	(void)len;
+	return 0;
+} // nullsink()
+
+static int getvar(cursor *cu, uint64_t *v)
+{
+	int shift;
+	*v = 0;
+	for (shift = 0; shift < 64 && cu->p < cu->end; shift += 7) {
+		unsigned char b = *cu->p++;
+		*v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) return 0;
+	}
+	return -1;
+} // getvar()
+
+static int nextedit(cursor *cu, uint64_t *gap, uint64_t *dellen)
+{	/* -1 if the body runs out or makes no sense */
+	uint64_t n;
+	if (getvar(cu, gap) || getvar(cu, dellen) || getvar(cu, &n)) return -1;
+	if (n & 1) return (cu->ins && n / 2 == cu->inslen) ? 0 : -1;
+	n /= 2;
+	if (n > (uint64_t)(cu->end - cu->p)) return -1;
+	cu->ins = cu->p;
+	cu->inslen = n;
+	cu->p += n;
+	return 0;
+} // nextedit()
@@ -0,0 +1,54 @@
+/*      patch.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _PATCH_H
+#define _PATCH_H
+#include <stdint.h>
+#include "libhexsed.h"
+
+/* A patch made by hexsed --emit-patch, in host byte order. An hxd_head
+ * then bodylen bytes of edits, each edit being
+ *	gap	bytes since the end of what the previous edit replaced
+ *	dellen	bytes replaced
+ *	inslen	* 2, plus 1 if the new bytes are the same as last time
+ *	and unless they are the same as last time, inslen new bytes.
+ * The numbers are LEB128 varints.
+*/
+#define HXD_MAGIC 0x44505848	// "HXPD"
+#define HXD_VERSION 1
+
+typedef struct hxd_head {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t insize;	// length of the file it applies to
+	uint64_t outsize;	// and of the patched file
+	uint64_t nedits;
+	uint64_t bodylen;
+	uint32_t oldcrc;	// CRC32C of all the bytes edits replace, in order
+	uint32_t bodycrc;
+	uint32_t pad;
+	uint32_t headcrc;	// of everything before it
+} hxd_head;
+
+void emitpatch(const char *fn, const hx_program *prog, const char *patchfn,
+				int quiet);
+void applypatch(const char *patchfn, const char *fn, int quiet);
+
+#endif
@@ -0,0 +1,914 @@
+/*      pipeline.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* Three stage edit pipeline. A reader thread fills fixed size blocks
+ * from the input fd, the caller (the matcher) consumes them and emits
+ * edited output into a second set of blocks, and a writer thread drains
+ * those to the output fd. Blocks only ever circulate between two
+ * lock free single producer/single consumer rings per direction, so
+ * after pl_open() nothing is allocated.
+ * A stage that finds its ring empty sleeps on a futex, it does not spin.
+ * With PL_URING the reader keeps every free block in flight as an
+ * io_uring read when the input is a regular file, and the writer does
+ * the same with output blocks when stdout is a regular file. Otherwise,
+ * or if io_uring is unavailable, plain read()/write() are used.
+ * Regular files are read extent by extent, SEEK_DATA/SEEK_HOLE, and
+ * holes are passed along as hole records which the writer turns back
+ * into holes when the output is a regular file.
+ * The blocks are carved from one huge page backed mapping, already
+ * faulted in and page aligned.
+ * With PL_DIRECT the input is read O_DIRECT into aligned blocks and the
+ * output is pushed out of the page cache behind the writer, so a big
+ * one shot edit does not evict everybody else's working set.
+ * Input that starts with gzip or zstd magic, or that is a pipe and can
+ * only be looked at once read, is expanded by the reader thread as it
+ * goes. With PL_GZIP or PL_ZSTD the writer hands output blocks round
+ * robin to a few compressor threads and writes the results in order.
+ * With PL_FOLLOW a regular file is read to its end and then watched
+ * with inotify, anything appended is read and handed on as it arrives.
+*/
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <signal.h>
+#include "fileops.h"
+#include "pipeline.h"
+#include "uring.h"
+#include "arena.h"
+#include "zio.h"
+
+static void ring_push(spsc *r, iobuf *b);
+static iobuf *ring_pop(spsc *r);
+static iobuf *ring_trypop(spsc *r);
+static int canuring(int fd, int forwrite);
+static int undirect(int fd);
+static void dropcache(int fd, off_t off, size_t len);
+static size_t readlen(pipeline *pl, size_t want);
+static void writezeros(int fd, iobuf *ob, off_t len);
+static void endhole(int fd, off_t end);
+static off_t extent(pipeline *pl, off_t pos, off_t size, int *isdata);
+static void *readerthread(void *arg);
+static void *writerthread(void *arg);
+static void *urreaderthread(void *arg);
+static void *urwriterthread(void *arg);
+static void *zreaderthread(void *arg);
+static void *zwriterthread(void *arg);
+static void *compressorthread(void *arg);
+static void *followthread(void *arg);
+static int fillraw(pipeline *pl, size_t *rlen, size_t want);
+static int sniff(int fd);
+
+pipeline *pl_open(int ifd, int ofd, size_t headroom, int flags)
+{	/* headroom is reserved in front of every input block so that the
+	 * matcher can prepend its carried over bytes without a copy of
+	 * the block itself.
+	*/
+	pipeline *pl = docalloc(1, sizeof(pipeline), "pl_open()");
+	pl->ifd = ifd;
+	pl->ofd = ofd;
+	pl->flags = flags;
+	// keeps data aligned for O_DIRECT
+	headroom = (headroom + PL_ALIGN - 1) & ~(size_t)(PL_ALIGN - 1);
+	pl->headroom = headroom;
+	pl->zin = (flags & PL_RAW) ? ZIO_PLAIN : sniff(ifd);
+	if ((flags & PL_DIRECT) && pl->zin == ZIO_PLAIN) {
+		int fl = fcntl(ifd, F_GETFL);
+		if (fl == -1 || fcntl(ifd, F_SETFL, fl | O_DIRECT) == -1) {
+			// fs can't do it, fall back to reading through the cache
+			posix_fadvise(ifd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		}
+	}
+	size_t insize = headroom + PL_BLOCKSIZE;
+	pl->pool = hugealloc(PL_NBUFS * (insize + PL_BLOCKSIZE),
+							&pl->poolsize);
+	if (!pl->pool) {
+		perror("pl_open()");
+		exit(EXIT_FAILURE);
+	}
+	int i;
+	for (i = 0; i < PL_NBUFS; i++) {
+		iobuf *ib = &pl->inbufs[i];
+		ib->base = pl->pool + i * insize;
+		iobuf *ob = &pl->outbufs[i];
+		ob->base = pl->pool + PL_NBUFS * insize + i * PL_BLOCKSIZE;
+		ib->data = ib->base + headroom;
+		ib->cap = PL_BLOCKSIZE;
+		ob->data = ob->base;
+		ob->cap = PL_BLOCKSIZE;
+		ring_push(&pl->infree, ib);
+		ring_push(&pl->outfree, ob);
+	}
+	pl->cur = ring_pop(&pl->outfree);
+	pl->cur->len = 0;
+	pl->cur->hole = 0;
+	void *(*rd)(void *) = readerthread;
+	void *(*wr)(void *) = writerthread;
+	if (flags & PL_URING) {
+		if (canuring(ifd, 0)) rd = urreaderthread;
+		if (canuring(ofd, 1)) wr = urwriterthread;
+	}
+	if (pl->zin != ZIO_PLAIN) {
+		rd = zreaderthread;
+		pl->raw = domalloc(PL_BLOCKSIZE, "pl_open()");
+	} else if (flags & PL_FOLLOW) {
+		/* Every thread started from here on inherits the blocked
+		 * signals, so they only ever arrive through the signalfd. */
+		sigset_t ss;
+		sigemptyset(&ss);
+		sigaddset(&ss, SIGINT);
+		sigaddset(&ss, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &ss, NULL);
+		pl->sigfd = signalfd(-1, &ss, SFD_CLOEXEC);
+		if (pl->sigfd == -1) {
+			perror("signalfd()");
+			exit(EXIT_FAILURE);
+		}
+		rd = followthread;
+	}
+	pl->zout = (flags & PL_GZIP) ? ZIO_GZIP :
+				(flags & PL_ZSTD) ? ZIO_ZSTD : ZIO_PLAIN;
+	if (pl->zout != ZIO_PLAIN) {
+		wr = zwriterthread;
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		pl->nz = (ncpu > PL_NZMAX) ? PL_NZMAX : (ncpu > 1) ? ncpu : 1;
+		size_t zcap = zenc_bound(pl->zout, PL_BLOCKSIZE);
+		for (i = 0; i < PL_NBUFS; i++) {
+			pl->zbuf[i] = domalloc(zcap, "pl_open()");
+		}
+		for (i = 0; i < pl->nz; i++) {
+			pl->zw[i].pl = pl;
+			pl->zw[i].idx = i;
+			if (pthread_create(&pl->zw[i].tid, NULL, compressorthread,
+								&pl->zw[i])) {
+				fputs("Could not start pipeline threads\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	if (pthread_create(&pl->reader, NULL, rd, pl) ||
+		pthread_create(&pl->writer, NULL, wr, pl)) {
+		fputs("Could not start pipeline threads\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	return pl;
+} // pl_open()
+
+iobuf *pl_next_input(pipeline *pl)
+{	/* returns NULL once the reader has hit end of input. A block with
+	 * len 0 and hole set stands for that many 0x00 bytes of a hole.
+	*/
+	iobuf *ib = ring_pop(&pl->infull);
+	if (ib->len == 0 && ib->hole == 0) {
+		ring_push(&pl->infree, ib);
+		return NULL;
+	}
+	return ib;
+} // pl_next_input()
+
+void pl_release_input(pipeline *pl, iobuf *ib)
+{
+	ring_push(&pl->infree, ib);
+} // pl_release_input()
+
+void pl_emit(pipeline *pl, const char *from, size_t len)
+{	/* copy len bytes into the output blocks, handing each one to the
+	 * writer as it fills. from NULL means len bytes of 0x00.
+	*/
+	while (len) {
+		iobuf *ob = pl->cur;
+		size_t room = ob->cap - ob->len;
+		size_t n = (len < room) ? len : room;
+		if (from) {
+			memcpy(ob->data + ob->len, from, n);
+			from += n;
+		} else {	// zeros, see pl_emit_hole()
+			memset(ob->data + ob->len, 0, n);
+		}
+		ob->len += n;
+		len -= n;
+		if (ob->len == ob->cap) {
+			ring_push(&pl->outfull, ob);
+			pl->cur = ring_pop(&pl->outfree);
+			pl->cur->len = 0;
+			pl->cur->hole = 0;
+		}
+	}
+} // pl_emit()
+
+void pl_emit_hole(pipeline *pl, off_t len)
+{	/* len bytes of 0x00 that the writer may leave as a hole */
+	if (pl->zout != ZIO_PLAIN) {	// compressed, the zeros cost nothing
+		pl_emit(pl, NULL, len);
+		return;
+	}
+	if (pl->cur->len) {
+		ring_push(&pl->outfull, pl->cur);
+		pl->cur = ring_pop(&pl->outfree);
+	}
+	pl->cur->len = 0;
+	pl->cur->hole = len;
+	ring_push(&pl->outfull, pl->cur);
+	pl->cur = ring_pop(&pl->outfree);
+	pl->cur->len = 0;
+	pl->cur->hole = 0;
+} // pl_emit_hole()
+
+void pl_flush(pipeline *pl)
+{	/* hand over the part filled output block now rather than when full */
+	if (pl->cur->len) {
+		ring_push(&pl->outfull, pl->cur);
+		pl->cur = ring_pop(&pl->outfree);
+		pl->cur->len = 0;
+		pl->cur->hole = 0;
+	}
+} // pl_flush()
+
+void pl_sync(pipeline *pl)
+{	/* pl_flush() and wait for the writer to have written everything,
+	 * which is when every block but cur is back in outfree. Not for
+	 * compressed output, those blocks come back before they're written.
+	*/
+	pl_flush(pl);
+	spsc *r = &pl->outfree;
+	size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+	while (1) {
+		unsigned int seen = atomic_load(&r->seq);
+		if (atomic_load_explicit(&r->tail, memory_order_acquire) - h ==
+			PL_NBUFS - 1) break;
+		atomic_fetch_add(&r->sleepers, 1);
+		if (atomic_load_explicit(&r->tail, memory_order_acquire) - h !=
+			PL_NBUFS - 1) {
+			syscall(SYS_futex, &r->seq, FUTEX_WAIT_PRIVATE, seen,
+					NULL, NULL, 0);
+		}
+		atomic_fetch_sub(&r->sleepers, 1);
+	}
+} // pl_sync()
+
+void pl_close(pipeline *pl)
+{	/* flush the part filled block, send the writer an empty one as the
+	 * end marker, and wait for both threads.
+	*/
+	if (pl->cur->len) {
+		ring_push(&pl->outfull, pl->cur);
+		pl->cur = ring_pop(&pl->outfree);
+	}
+	pl->cur->len = 0;
+	pl->cur->hole = 0;
+	ring_push(&pl->outfull, pl->cur);
+	pthread_join(pl->writer, NULL);
+	pthread_join(pl->reader, NULL);
+	int i;
+	for (i = 0; i < PL_NBUFS; i++) free(pl->zbuf[i]);
+	free(pl->raw);
+	if (pl->sigfd > 0) close(pl->sigfd);
+	hugefree(pl->pool, pl->poolsize);
+	free(pl);
+} // pl_close()
+
+static void ring_push(spsc *r, iobuf *b)
+{	/* never blocks, there are only ever PL_NBUFS blocks in circulation
+	 * so a ring can not overfill.
+	*/
+	size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	r->slot[t % PL_NBUFS] = b;
+	atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+	atomic_fetch_add(&r->seq, 1);
+	if (atomic_load(&r->sleepers)) {
+		syscall(SYS_futex, &r->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL,
+				0);
+	}
+} // ring_push()
+
+static iobuf *ring_pop(spsc *r)
+{	/* waits until the producer has pushed something. */
+	size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+	while (1) {
+		unsigned int seen = atomic_load(&r->seq);
+		if (atomic_load_explicit(&r->tail, memory_order_acquire) != h)
+			break;
+		atomic_fetch_add(&r->sleepers, 1);
+		if (atomic_load_explicit(&r->tail, memory_order_acquire) == h) {
+			syscall(SYS_futex, &r->seq, FUTEX_WAIT_PRIVATE, seen,
+					NULL, NULL, 0);
+		}
+		atomic_fetch_sub(&r->sleepers, 1);
+	}
+	iobuf *b = r->slot[h % PL_NBUFS];
+	atomic_store_explicit(&r->head, h + 1, memory_order_release);
+	return b;
+} // ring_pop()
+
+static iobuf *ring_trypop(spsc *r)
+{	/* as ring_pop() but returns NULL rather than wait. */
+	size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+	if (atomic_load_explicit(&r->tail, memory_order_acquire) == h)
+		return NULL;
+	iobuf *b = r->slot[h % PL_NBUFS];
+	atomic_store_explicit(&r->head, h + 1, memory_order_release);
+	return b;
+} // ring_trypop()
+
+static int canuring(int fd, int forwrite)
+{	/* Reads and writes are issued at explicit offsets, so only regular
+	 * files qualify, and writes not if the fd is O_APPEND.
+	*/
+	struct stat sb;
+	if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode)) return 0;
+	if (forwrite && (fcntl(fd, F_GETFL) & O_APPEND)) return 0;
+	uring u;
+	if (ur_init(&u, PL_NBUFS) == -1) return 0;
+	ur_exit(&u);
+	return 1;
+} // canuring()
+
+static int undirect(int fd)
+{	/* O_DIRECT refuses the unaligned tail of a file, or a short read
+	 * left us unaligned. Returns 1 if O_DIRECT was on and is now off,
+	 * meaning the failed read is worth retrying through the cache.
+	*/
+	int fl = fcntl(fd, F_GETFL);
+	if (fl == -1 || !(fl & O_DIRECT)) return 0;
+	return fcntl(fd, F_SETFL, fl & ~O_DIRECT) == 0;
+} // undirect()
+
+static void dropcache(int fd, off_t off, size_t len)
+{	/* Start writeback of the block just written, then wait for all
+	 * before it and drop those pages. POSIX_FADV_DONTNEED on its own
+	 * leaves dirty pages where they are.
+	*/
+	if (off == -1) return;	// not seekable, nothing cached
+	sync_file_range(fd, off, len, SYNC_FILE_RANGE_WRITE);
+	if (off == 0) return;
+	sync_file_range(fd, 0, off, SYNC_FILE_RANGE_WAIT_BEFORE |
+					SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	posix_fadvise(fd, 0, off, POSIX_FADV_DONTNEED);
+} // dropcache()
+
+static void *readerthread(void *arg)
+{	/* Fill whole blocks. A regular file is read extent by extent so
+	 * that holes go to the matcher as hole records and are never read.
+	*/
+	pipeline *pl = arg;
+	struct stat sb;
+	off_t roff = lseek(pl->ifd, 0, SEEK_CUR);
+	int regular = (roff != -1 && fstat(pl->ifd, &sb) == 0 &&
+					S_ISREG(sb.st_mode));
+	off_t size = regular ? sb.st_size : 0;
+	off_t extend = 0;	// end of the data or hole roff is in
+	int isdata = 1;
+	while (1) {
+		iobuf *ib = ring_pop(&pl->infree);
+		ib->len = 0;
+		ib->hole = 0;
+		if (regular && roff >= size) {
+			ring_push(&pl->infull, ib);	// end marker
+			break;
+		}
+		size_t want = ib->cap;
+		if (regular) {
+			if (roff >= extend) extend = extent(pl, roff, size, &isdata);
+			if (!isdata) {
+				ib->hole = extend - roff;
+				roff = extend;
+				ring_push(&pl->infull, ib);
+				continue;
+			}
+			if (extend - roff < (off_t)want) want = extend - roff;
+		}
+		while (ib->len < want) {
+			ssize_t res;
+			if (regular) {
+				res = pread(pl->ifd, ib->data + ib->len, want - ib->len,
+							roff + ib->len);
+			} else {
+				res = read(pl->ifd, ib->data + ib->len, want - ib->len);
+			}
+			if (res == -1) {
+				if (errno == EINTR) continue;
+				if (errno == EINVAL && undirect(pl->ifd)) continue;
+				perror("read()");
+				exit(EXIT_FAILURE);
+			}
+			if (res == 0) break;
+			ib->len += res;
+		}
+		if (regular && ib->len < want) size = roff + ib->len;	// shrank
+		if ((pl->flags & PL_DIRECT) && regular) {
+			posix_fadvise(pl->ifd, roff, ib->len, POSIX_FADV_DONTNEED);
+		}
+		roff += ib->len;
+		ring_push(&pl->infull, ib);
+		if (ib->len == 0) break;	// that was the end marker
+	}
+	return NULL;
+} // readerthread()
+
+static void *writerthread(void *arg)
+{
+	pipeline *pl = arg;
+	struct stat sb;
+	off_t woff = lseek(pl->ofd, 0, SEEK_CUR);
+	int regular = (woff != -1 && fstat(pl->ofd, &sb) == 0 &&
+					S_ISREG(sb.st_mode) &&
+					!(fcntl(pl->ofd, F_GETFL) & O_APPEND));	// >> seeks in vain
+	while (1) {
+		iobuf *ob = ring_pop(&pl->outfull);
+		if (ob->len == 0 && ob->hole == 0) break;
+		if (ob->hole) {
+			if (regular) {	// leave it a hole
+				woff = lseek(pl->ofd, ob->hole, SEEK_CUR);
+			} else {
+				writezeros(pl->ofd, ob, ob->hole);
+			}
+			ring_push(&pl->outfree, ob);
+			continue;
+		}
+		writeall(pl->ofd, ob->data, ob->len);
+		if (pl->flags & PL_DIRECT) dropcache(pl->ofd, woff, ob->len);
+		if (woff != -1) woff += ob->len;
+		ring_push(&pl->outfree, ob);
+	}
+	if (regular) endhole(pl->ofd, woff);
+	if (pl->flags & PL_DIRECT) dropcache(pl->ofd, woff, 0);
+	return NULL;
+} // writerthread()
+
+static void writezeros(int fd, iobuf *ob, off_t len)
+{	/* a hole going somewhere that can't have one, ob is free to use */
+	memset(ob->data, 0, ob->cap);
+	while (len) {
+		size_t n = (len < (off_t)ob->cap) ? (size_t)len : ob->cap;
+		writeall(fd, ob->data, n);
+		len -= n;
+	}
+} // writezeros()
+
+static void endhole(int fd, off_t end)
+{	/* Seeking past the end writes nothing, so output that finishes in
+	 * a hole needs the file extended to its proper length.
+	*/
+	struct stat sb;
+	if (fstat(fd, &sb) == 0 && sb.st_size < end) {
+		if (ftruncate(fd, end) == -1) {
+			perror("ftruncate()");
+			exit(EXIT_FAILURE);
+		}
+	}
+} // endhole()
+
+static off_t extent(pipeline *pl, off_t pos, off_t size, int *isdata)
+{	/* Returns the end of the data or hole extent that pos is in and
+	 * sets isdata to say which. Where SEEK_DATA isn't supported the
+	 * whole file is data.
+	*/
+	*isdata = 1;
+	if (pl->nosparse) return size;
+	off_t d = lseek(pl->ifd, pos, SEEK_DATA);
+	if (d == -1) {
+		if (errno == ENXIO) {	// nothing but hole from pos to the end
+			*isdata = 0;
+			return size;
+		}
+		pl->nosparse = 1;
+		return size;
+	}
+	if (d > pos) {
+		*isdata = 0;
+		return (d < size) ? d : size;
+	}
+	off_t h = lseek(pl->ifd, pos, SEEK_HOLE);
+	if (h == -1 || h > size) h = size;
+	return h;
+} // extent()
+
+static size_t readlen(pipeline *pl, size_t want)
+{	/* O_DIRECT wants whole sectors even for the tail of the file, the
+	 * block has the room and the kernel stops at end of file.
+	*/
+	if (!(pl->flags & PL_DIRECT)) return want;
+	return (want + PL_ALIGN - 1) & ~(size_t)(PL_ALIGN - 1);
+} // readlen()
+
+static void *urreaderthread(void *arg)
+{	/* Keeps up to PL_NBUFS reads in flight ahead of the matcher. They
+	 * may complete in any order but are handed on in file order. Holes
+	 * take a block as a hole record but need no read.
+	*/
+	pipeline *pl = arg;
+	uring u;
+	if (ur_init(&u, PL_NBUFS) == -1) return readerthread(arg);
+	struct iovec iov[PL_NBUFS];
+	size_t want[PL_NBUFS];
+	off_t off[PL_NBUFS];
+	int done[PL_NBUFS];
+	iobuf *fifo[PL_NBUFS];	// in flight, oldest first
+	size_t fh = 0, ft = 0;
+	int i;
+	for (i = 0; i < PL_NBUFS; i++) {
+		iov[i].iov_base = pl->inbufs[i].base;
+		iov[i].iov_len = pl->headroom + pl->inbufs[i].cap;
+	}
+	ur_register(&u, iov, PL_NBUFS);
+	struct stat sb;
+	if (fstat(pl->ifd, &sb) == -1) {
+		perror("fstat()");
+		exit(EXIT_FAILURE);
+	}
+	off_t size = sb.st_size;
+	off_t next = lseek(pl->ifd, 0, SEEK_CUR);
+	if (next == -1) next = 0;
+	off_t extend = 0;
+	int isdata = 1;
+	while (1) {
+		while (next < size && ft - fh < PL_NBUFS) {
+			iobuf *ib = (ft == fh) ? ring_pop(&pl->infree)
+									: ring_trypop(&pl->infree);
+			if (!ib) break;
+			i = ib - pl->inbufs;
+			ib->len = 0;
+			ib->hole = 0;
+			fifo[ft++ % PL_NBUFS] = ib;
+			if (next >= extend) extend = extent(pl, next, size, &isdata);
+			if (!isdata) {
+				ib->hole = extend - next;
+				next = extend;
+				done[i] = 1;
+				continue;
+			}
+			want[i] = (extend - next < (off_t)ib->cap) ?
+						(size_t)(extend - next) : ib->cap;
+			off[i] = next;
+			done[i] = 0;
+			ur_prep(&u, 0, pl->ifd, ib->data, readlen(pl, want[i]),
+					next, i, i);
+			next += want[i];
+		}
+		ur_submit(&u);
+		while (fh != ft && done[fifo[fh % PL_NBUFS] - pl->inbufs]) {
+			iobuf *ib = fifo[fh++ % PL_NBUFS];
+			if (ib->len || ib->hole) {
+				ring_push(&pl->infull, ib);
+			} else {
+				ring_push(&pl->infree, ib);
+			}
+		}
+		if (ft == fh) {
+			if (next >= size) break;
+			continue;
+		}
+		unsigned long long tag;
+		int res = ur_wait(&u, &tag);
+		iobuf *ib = &pl->inbufs[tag];
+		i = tag;
+		if (res == -EINVAL && undirect(pl->ifd)) {
+			ur_prep(&u, 0, pl->ifd, ib->data + ib->len,
+					want[i] - ib->len, off[i] + ib->len, i, i);
+			continue;
+		}
+		if (res < 0) {
+			errno = -res;
+			perror("read()");
+			exit(EXIT_FAILURE);
+		}
+		ib->len += res;
+		if (ib->len > want[i]) ib->len = want[i];	// grew, readlen()
+		if (res == 0) {	// file shrank under us
+			want[i] = ib->len;
+			if (off[i] + (off_t)ib->len < size) size = off[i] + ib->len;
+		} else if (ib->len < want[i]) {	// short read, go again
+			ur_prep(&u, 0, pl->ifd, ib->data + ib->len,
+					want[i] - ib->len, off[i] + ib->len, i, i);
+			continue;
+		}
+		if (pl->flags & PL_DIRECT) {
+			posix_fadvise(pl->ifd, off[i], ib->len, POSIX_FADV_DONTNEED);
+		}
+		done[i] = 1;
+	}
+	ur_exit(&u);
+	iobuf *ib = ring_pop(&pl->infree);
+	ib->len = 0;	// end marker
+	ib->hole = 0;
+	ring_push(&pl->infull, ib);
+	return NULL;
+} // urreaderthread()
+
+static void *urwriterthread(void *arg)
+{	/* Submits each output block as soon as the matcher hands it over,
+	 * at its own offset, so several writes can be in flight at once.
+	*/
+	pipeline *pl = arg;
+	uring u;
+	if (ur_init(&u, PL_NBUFS) == -1) return writerthread(arg);
+	struct iovec iov[PL_NBUFS];
+	size_t sent[PL_NBUFS];
+	off_t woff[PL_NBUFS];
+	int i;
+	for (i = 0; i < PL_NBUFS; i++) {
+		iov[i].iov_base = pl->outbufs[i].base;
+		iov[i].iov_len = pl->outbufs[i].cap;
+	}
+	ur_register(&u, iov, PL_NBUFS);
+	off_t off = lseek(pl->ofd, 0, SEEK_CUR);
+	int inflight = 0, end = 0;
+	while (1) {
+		while (!end) {
+			iobuf *ob = inflight ? ring_trypop(&pl->outfull)
+									: ring_pop(&pl->outfull);
+			if (!ob) break;
+			if (ob->len == 0 && ob->hole == 0) {
+				end = 1;
+				break;
+			}
+			if (ob->hole) {	// just skip the offset along
+				off += ob->hole;
+				ring_push(&pl->outfree, ob);
+				continue;
+			}
+			i = ob - pl->outbufs;
+			sent[i] = 0;
+			woff[i] = off;
+			off += ob->len;
+			ur_prep(&u, 1, pl->ofd, ob->data, ob->len, woff[i], i, i);
+			inflight++;
+		}
+		ur_submit(&u);
+		if (!inflight) break;
+		unsigned long long tag;
+		int res = ur_wait(&u, &tag);
+		i = tag;
+		iobuf *ob = &pl->outbufs[i];
+		if (res < 0) {
+			errno = -res;
+			perror("write()");
+			exit(EXIT_FAILURE);
+		}
+		sent[i] += res;
+		if (sent[i] < ob->len) {
+			ur_prep(&u, 1, pl->ofd, ob->data + sent[i], ob->len - sent[i],
+					woff[i] + sent[i], i, i);
+			continue;
+		}
+		if (pl->flags & PL_DIRECT) dropcache(pl->ofd, woff[i], ob->len);
+		inflight--;
+		ring_push(&pl->outfree, ob);
+	}
+	ur_exit(&u);
+	endhole(pl->ofd, off);
+	if (pl->flags & PL_DIRECT) dropcache(pl->ofd, off, 0);
+	lseek(pl->ofd, off, SEEK_SET);	// anything written after us follows on
+	return NULL;
+} // urwriterthread()
+
+static int sniff(int fd)
+{	/* What a regular file is compressed with, by its first bytes. Other
+	 * input can't be read twice, so the reader finds out, -1.
+	*/
+	struct stat sb;
+	off_t off = lseek(fd, 0, SEEK_CUR);
+	if (off == -1 || fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode))
+		return -1;
+	char magic[ZIO_MAGICLEN];
+	ssize_t n = pread(fd, magic, sizeof(magic), off);
+	return (n > 0) ? zio_sniff(magic, n) : ZIO_PLAIN;
+} // sniff()
+
+static int fillraw(pipeline *pl, size_t *rlen, size_t want)
+{	/* Read on into pl->raw until it holds want bytes, returns 1 at end
+	 * of input.
+	*/
+	while (*rlen < want) {
+		ssize_t res = read(pl->ifd, pl->raw + *rlen, PL_BLOCKSIZE - *rlen);
+		if (res == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EINVAL && undirect(pl->ifd)) continue;
+			perror("read()");
+			exit(EXIT_FAILURE);
+		}
+		if (res == 0) return 1;
+		*rlen += res;
+	}
+	return 0;
+} // fillraw()
+
+static void *zreaderthread(void *arg)
+{	/* Compressed input, or a pipe that might be. Raw input is read into
+	 * pl->raw and expanded into whole blocks, or when the first bytes
+	 * turn out to be plain, just copied across.
+	*/
+	pipeline *pl = arg;
+	size_t rlen = 0, rpos = 0;
+	int eof = fillraw(pl, &rlen, ZIO_MAGICLEN);
+	if (pl->zin == -1) pl->zin = zio_sniff(pl->raw, rlen);
+	zdec *zd = NULL;
+	if (pl->zin != ZIO_PLAIN) {
+		if (!zio_have(pl->zin)) {
+			fprintf(stderr, "Input is %s compressed, and this hexsed was"
+					" built without %s support\n", zio_name(pl->zin),
+					zio_name(pl->zin));
+			exit(EXIT_FAILURE);
+		}
+		zd = zdec_new(pl->zin);
+		if (!zd) {
+			fputs("Failed to get memory in zreaderthread()\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	iobuf *ib = NULL;
+	while (1) {
+		if (rpos == rlen && !eof) {
+			rlen = rpos = 0;
+			eof = fillraw(pl, &rlen, 1);
+		}
+		if (!ib) {
+			ib = ring_pop(&pl->infree);
+			ib->len = 0;
+			ib->hole = 0;
+		}
+		size_t had = ib->len;
+		if (zd) {
+			const char *in = pl->raw + rpos;
+			size_t inlen = rlen - rpos;
+			if (zdec_step(zd, &in, &inlen, ib->data, &ib->len, ib->cap)) {
+				fprintf(stderr, "Corrupt %s input\n", zio_name(pl->zin));
+				exit(EXIT_FAILURE);
+			}
+			rpos = rlen - inlen;
+		} else {
+			size_t n = rlen - rpos;
+			if (n > ib->cap - ib->len) n = ib->cap - ib->len;
+			memcpy(ib->data + ib->len, pl->raw + rpos, n);
+			ib->len += n;
+			rpos += n;
+		}
+		if (ib->len == ib->cap) {
+			ring_push(&pl->infull, ib);
+			ib = NULL;
+		} else if (eof && rpos == rlen && ib->len == had) {
+			break;	// nothing more to come
+		}
+	}
+	if (zd && !zdec_done(zd)) {
+		fprintf(stderr, "Truncated %s input\n", zio_name(pl->zin));
+		exit(EXIT_FAILURE);
+	}
+	if (zd && zdec_junk(zd)) {
+		fprintf(stderr, "Trailing garbage after %s input ignored\n",
+				zio_name(pl->zin));
+	}
+	zdec_free(zd);
+	if (ib->len) {
+		ring_push(&pl->infull, ib);
+		ib = ring_pop(&pl->infree);
+	}
+	ib->len = 0;	// end marker
+	ib->hole = 0;
+	ring_push(&pl->infull, ib);
+	return NULL;
+} // zreaderthread()
+
+static void *compressorthread(void *arg)
+{	/* compresses whatever block the writer passes it, until the empty
+	 * one that means stop.
+	*/
+	struct zworker *zw = arg;
+	pipeline *pl = zw->pl;
+	size_t zcap = zenc_bound(pl->zout, PL_BLOCKSIZE);
+	while (1) {
+		iobuf *ob = ring_pop(&pl->ztodo[zw->idx]);
+		if (ob->len == 0) break;
+		int i = ob - pl->outbufs;
+		pl->zlen[i] = zenc_block(pl->zout, ob->data, ob->len, pl->zbuf[i],
+									zcap);
+		if (pl->zlen[i] == 0) {
+			fprintf(stderr, "Could not %s compress\n", zio_name(pl->zout));
+			exit(EXIT_FAILURE);
+		}
+		ring_push(&pl->zdone[zw->idx], ob);
+	}
+	return NULL;
+} // compressorthread()
+
+static void *zwriterthread(void *arg)
+{	/* Block n goes to compressor n % nz and comes back from it, so
+	 * taking them back in the same order keeps the output in order.
+	 * pl_emit_hole() has turned any holes into zeros already.
+	*/
+	pipeline *pl = arg;
+	off_t woff = lseek(pl->ofd, 0, SEEK_CUR);
+	size_t sent = 0, got = 0;
+	int end = 0;
+	while (1) {
+		while (!end) {
+			iobuf *ob = (sent == got) ? ring_pop(&pl->outfull)
+									: ring_trypop(&pl->outfull);
+			if (!ob) break;
+			if (ob->len == 0) {
+				end = 1;
+				break;
+			}
+			ring_push(&pl->ztodo[sent++ % pl->nz], ob);
+		}
+		if (sent == got) break;	// and end is set
+		iobuf *ob = ring_pop(&pl->zdone[got++ % pl->nz]);
+		int i = ob - pl->outbufs;
+		writeall(pl->ofd, pl->zbuf[i], pl->zlen[i]);
+		if (pl->flags & PL_DIRECT) dropcache(pl->ofd, woff, pl->zlen[i]);
+		if (woff != -1) woff += pl->zlen[i];
+		ring_push(&pl->outfree, ob);
+	}
+	iobuf stop = {0};
+	int i;
+	for (i = 0; i < pl->nz; i++) {
+		ring_push(&pl->ztodo[i], &stop);
+		pthread_join(pl->zw[i].tid, NULL);
+	}
+	if (pl->flags & PL_DIRECT) dropcache(pl->ofd, woff, 0);
+	return NULL;
+} // zwriterthread()
+
+static void *followthread(void *arg)
+{	/* Read to the end, then wait for the file to grow and read on. A
+	 * block goes to the matcher as soon as a read puts anything in it,
+	 * so output follows input closely. SIGINT or SIGTERM ends the input.
+	*/
+	pipeline *pl = arg;
+	char path[64];
+	sprintf(path, "/proc/self/fd/%d", pl->ifd);
+	int ino = inotify_init1(IN_CLOEXEC);
+	if (ino == -1 || inotify_add_watch(ino, path, IN_MODIFY) == -1) {
+		perror("inotify");
+		exit(EXIT_FAILURE);
+	}
+	off_t roff = lseek(pl->ifd, 0, SEEK_CUR);
+	if (roff == -1) roff = 0;
+	iobuf *ib = NULL;
+	while (1) {
+		if (!ib) {
+			ib = ring_pop(&pl->infree);
+			ib->len = 0;
+			ib->hole = 0;
+		}
+		ssize_t res = pread(pl->ifd, ib->data, ib->cap, roff);
+		if (res == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EINVAL && undirect(pl->ifd)) continue;
+			perror("read()");
+			exit(EXIT_FAILURE);
+		}
+		if (res > 0) {
+			ib->len = res;
+			roff += res;
+			ring_push(&pl->infull, ib);
+			ib = NULL;
+			continue;
+		}
+		struct stat sb;
+		if (fstat(pl->ifd, &sb) == 0 && sb.st_size < roff) {
+			fputs("Input truncated, following it from the start\n",
+					stderr);
+			roff = 0;
+			continue;
+		}
+		// caught up, the watch was set before the read so nothing is missed
+		struct pollfd pfd[2] = { { ino, POLLIN, 0 },
+								{ pl->sigfd, POLLIN, 0 } };
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR) continue;
+			perror("poll()");
+			exit(EXIT_FAILURE);
+		}
+		if (pfd[1].revents) break;
+		char evbuf[4096];
+		if (read(ino, evbuf, sizeof(evbuf)) == -1 && errno != EINTR) {
+			perror("inotify");
+			exit(EXIT_FAILURE);
+		}
+	}
+	close(ino);
+	ib->len = 0;	// end marker
+	ib->hole = 0;
+	ring_push(&pl->infull, ib);
+	return NULL;
+} // followthread()
@@ -0,0 +1,101 @@
+/*      pipeline.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* Size of each block handed between the stages, and how many of them
+ * each direction owns. Nothing is allocated once the pipeline is open.
+*/
+#define PL_BLOCKSIZE (1024 * 1024)
+#define PL_NBUFS 8
+
+/* pl_open() flags */
+#define PL_URING 1	// use io_uring where the kernel and the fds allow
+#define PL_DIRECT 2	// O_DIRECT input, drop output from the page cache
+#define PL_GZIP 4	// compress the output
+#define PL_ZSTD 8
+#define PL_FOLLOW 16	// at end of input wait for more, till SIGINT/SIGTERM
+#define PL_RAW 32	// take the input as it is even if it looks compressed
+
+#define PL_NZMAX 6	// most output compressor threads
+
+#define PL_ALIGN 4096	// O_DIRECT buffer, offset and length alignment
+
+typedef struct iobuf {
+	char *base;		// start of the allocation
+	char *data;		// base + headroom, where the payload starts
+	size_t len;		// payload bytes, 0 and no hole marks end of input
+	size_t cap;		// payload capacity
+	off_t hole;		// with len 0, this many 0x00 bytes of a hole
+} iobuf;
+
+typedef struct spsc {	// single producer, single consumer ring
+	iobuf *slot[PL_NBUFS];
+	_Atomic size_t head;	// next slot the consumer takes
+	_Atomic size_t tail;	// next slot the producer fills
+	_Atomic unsigned int seq;	// futex word, bumped on every push
+	_Atomic int sleepers;
+} spsc;
+
+typedef struct pipeline {
+	int ifd;
+	int ofd;
+	int flags;
+	int nosparse;	// input fs has no SEEK_DATA
+	size_t headroom;
+	char *pool;	// every block lives in this one mapping
+	size_t poolsize;
+	iobuf inbufs[PL_NBUFS];
+	iobuf outbufs[PL_NBUFS];
+	spsc infree, infull;	// reader <-> matcher
+	spsc outfree, outfull;	// matcher <-> writer
+	iobuf *cur;	// output block being filled by the matcher
+	pthread_t reader, writer;
+	int sigfd;	// PL_FOLLOW, signalfd for SIGINT and SIGTERM
+	int zin;	// ZIO_* the input is compressed with, -1 not known yet
+	int zout;	// and the output is to be
+	char *raw;	// compressed input before it is expanded into a block
+	char *zbuf[PL_NBUFS];	// outbufs[i] compressed
+	size_t zlen[PL_NBUFS];
+	int nz;	// compressor threads, each fed by the writer
+	spsc ztodo[PL_NZMAX], zdone[PL_NZMAX];
+	struct zworker {
+		struct pipeline *pl;
+		int idx;
+		pthread_t tid;
+	} zw[PL_NZMAX];
+} pipeline;
+
+pipeline *pl_open(int ifd, int ofd, size_t headroom, int flags);
+iobuf *pl_next_input(pipeline *pl);
+void pl_release_input(pipeline *pl, iobuf *ib);
+void pl_emit(pipeline *pl, const char *from, size_t len);
+void pl_emit_hole(pipeline *pl, off_t len);
+void pl_flush(pipeline *pl);
+void pl_sync(pipeline *pl);
+void pl_close(pipeline *pl);
+// Reader thread -> matcher -> writer thread, see pipeline.c
+
+#endif
@@ -0,0 +1,165 @@
+/*      progress.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#include <signal.h>
+#include "fileops.h"
+#include "progress.h"
+
+static void *reporter(void *arg);
+static void putline(progress *pg);
+static void putstats(progress *pg);
+static double elapsed(const progress *pg);
+static char *human(uint64_t n, char *buf);
+
+progress *pg_start(uint64_t total, int interval, const char *statsfn)
+{
+	progress *pg = docalloc(1, sizeof(progress), "pg_start()");
+	pg->total = total;
+	pg->interval = interval;
+	pg->statsfn = statsfn;
+	clock_gettime(CLOCK_MONOTONIC, &pg->start);
+	sigset_t ss;
+	sigemptyset(&ss);
+	sigaddset(&ss, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+	if (pthread_create(&pg->tid, NULL, reporter, pg)) {
+		fputs("Could not start the progress thread\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	return pg;
+} // pg_start()
+
+void pg_stop(progress *pg)
+{	/* one last report, complete this time */
+	atomic_store(&pg->done, 1);
+	pthread_kill(pg->tid, SIGUSR1);
+	pthread_join(pg->tid, NULL);
+	if (pg->interval) putline(pg);
+	if (pg->statsfn) putstats(pg);
+	free(pg);
+} // pg_stop()
+
+static void *reporter(void *arg)
+{	/* SIGUSR1 prints a line whether or not --progress asked for them.
+	 * Every signal is blocked here, so one sent to the process, SIGTERM
+	 * to a --follow, goes to a thread that is ready for it.
+	*/
+	progress *pg = arg;
+	sigset_t ss;
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+	sigemptyset(&ss);
+	sigaddset(&ss, SIGUSR1);
+	int tick = pg->interval ? pg->interval : (pg->statsfn ? 1 : 0);
+	struct timespec ts = { tick, 0 };
+	while (1) {
+		int sig = sigtimedwait(&ss, NULL, tick ? &ts : NULL);
+		if (atomic_load(&pg->done)) break;
+		if (sig == SIGUSR1) {
+			putline(pg);
+		} else if (sig == -1 && errno == EAGAIN) {
+			if (pg->interval) putline(pg);
+			if (pg->statsfn) putstats(pg);
+		}
+	}
+	return NULL;
+} // reporter()
+
+static void putline(progress *pg)
+{
+	uint64_t scanned = atomic_load_explicit(&pg->scanned,
+											memory_order_relaxed);
+	uint64_t edits = atomic_load_explicit(&pg->edits, memory_order_relaxed);
+	uint64_t written = atomic_load_explicit(&pg->written,
+											memory_order_relaxed);
+	double secs = elapsed(pg);
+	uint64_t rate = (secs > 0) ? scanned / secs : 0;
+	char b1[16], b2[16], b3[16], b4[16];
+	char line[160];
+	int n = sprintf(line, "hexsed: %s", human(scanned, b1));
+	if (pg->total) {
+		n += sprintf(line + n, " of %s, %d%%", human(pg->total, b2),
+					(int)(scanned * 100 / pg->total));
+	}
+	n += sprintf(line + n, ", %llu edits, %s out, %s/s",
+				(unsigned long long)edits, human(written, b3),
+				human(rate, b4));
+	if (pg->total && rate && scanned < pg->total) {
+		uint64_t left = (pg->total - scanned) / rate;
+		n += sprintf(line + n, ", %llu:%02u:%02u left",
+					(unsigned long long)left / 3600,
+					(unsigned)(left / 60 % 60), (unsigned)(left % 60));
+	}
+	line[n++] = '\n';
+	if (write(2, line, n) == -1) {}	// nothing to be done about it
+} // putline()
+
+static void putstats(progress *pg)
+{	/* written beside the stats file and renamed over it, a reader never
+	 * sees half of one.
+	*/
+	char tmp[PATH_MAX];
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", pg->statsfn) >= PATH_MAX)
+		return;
+	FILE *fp = fopen(tmp, "w");
+	if (!fp) {
+		perror(tmp);
+		return;
+	}
+	double secs = elapsed(pg);
+	uint64_t scanned = atomic_load_explicit(&pg->scanned,
+											memory_order_relaxed);
+	fprintf(fp, "scanned %llu\n", (unsigned long long)scanned);
+	fprintf(fp, "total %llu\n", (unsigned long long)pg->total);
+	fprintf(fp, "edits %llu\n", (unsigned long long)
+			atomic_load_explicit(&pg->edits, memory_order_relaxed));
+	fprintf(fp, "written %llu\n", (unsigned long long)
+			atomic_load_explicit(&pg->written, memory_order_relaxed));
+	fprintf(fp, "elapsed %.3f\n", secs);
+	fprintf(fp, "rate %llu\n",
+			(unsigned long long)((secs > 0) ? scanned / secs : 0));
+	fprintf(fp, "done %d\n", atomic_load(&pg->done));
+	if (fclose(fp) == EOF || rename(tmp, pg->statsfn) == -1) {
+		perror(pg->statsfn);
+		unlink(tmp);
+	}
+} // putstats()
+
+static double elapsed(const progress *pg)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - pg->start.tv_sec) +
+			(now.tv_nsec - pg->start.tv_nsec) / 1e9;
+} // elapsed()
+
+static char *human(uint64_t n, char *buf)
+{	/* 1023 B, 1.00 KiB ... */
+	const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB" };
+	double d = n;
+	int u = 0;
+	while (d >= 1024 && u < 6) {
+		d /= 1024;
+		u++;
+	}
+	if (u == 0) sprintf(buf, "%llu B", (unsigned long long)n);
+	else sprintf(buf, "%.2f %s", d, units[u]);
+	return buf;
+} // human()
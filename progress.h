@@ -0,0 +1,55 @@
+/*      progress.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _PROGRESS_H
+#define _PROGRESS_H
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef struct progress {
+	_Atomic uint64_t scanned;	// input bytes
+	_Atomic uint64_t edits;
+	_Atomic uint64_t written;	// output bytes, before any compression
+	uint64_t total;	// input size, 0 if not known
+	int interval;	// seconds between --progress lines, 0 for none
+	const char *statsfn;
+	struct timespec start;
+	atomic_int done;
+	pthread_t tid;
+} progress;
+
+progress *pg_start(uint64_t total, int interval, const char *statsfn);
+void pg_stop(progress *pg);
+/* A thread that reports on SIGUSR1, every interval seconds and to the
+ * stats file. Start it before any other thread so they all inherit
+ * SIGUSR1 blocked.
+*/
+
+static inline void pg_update(progress *pg, uint64_t scanned, uint64_t edits,
+								uint64_t written)
+{	/* once a block, nobody needs these ordered */
+	atomic_store_explicit(&pg->scanned, scanned, memory_order_relaxed);
+	atomic_store_explicit(&pg->edits, edits, memory_order_relaxed);
+	atomic_store_explicit(&pg->written, written, memory_order_relaxed);
+} // pg_update()
+
+#endif
@@ -0,0 +1,434 @@
+/*      records.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* hexsed --records and --record-length. The input is cut into records,
+ * at each delimiter or every reclen bytes, and each record is edited as
+ * an input of its own: a match never spans two records and the =count
+ * counts in each. --range and --containing choose which records are
+ * edited at all, the rest go out as they are, and so do delimiters.
+ * The input, mapped or read whole from a pipe, is cut into chunks of
+ * whole records that a pool of workers edit at the same time, each into
+ * a buffer of its own that this thread writes out in order.
+*/
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "fileops.h"
+#include "zio.h"
+#include "records.h"
+
+typedef struct recbuf {
+	char *from;
+	size_t len;
+	size_t cap;
+} recbuf;
+
+typedef struct chunk {
+	const char *from;
+	size_t len;
+	uint64_t first;	// number of its first record, from 1
+	uint64_t nrec;
+	recbuf out;	// from NULL when it goes out unedited
+	long count;
+	int done;
+} chunk;
+
+typedef struct job {
+	const hx_program *prog;
+	const char *delim;	// or every reclen bytes
+	size_t dlen;
+	size_t reclen;
+	uint64_t lo, hi;	// --range
+	const char *has;	// --containing
+	size_t hlen;
+	chunk *ch;
+	size_t nch;
+	size_t next;	// the next chunk for a worker
+	size_t written;	// chunks gone out
+	size_t window;	// chunks in hand at most, done or not
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} job;
+
+static void parserange(const char *range, uint64_t *lo, uint64_t *hi);
+static char *slurp(int fd, const char *fn, size_t *len);
+static void cutchunks(job *jb, const char *in, size_t len);
+static const char *nextdelim(const job *jb, const char *base,
+								const char *p, const char *end);
+static uint64_t countrecs(const job *jb, const chunk *c);
+static uint64_t countbyte(const char *p, size_t len, unsigned char d);
+static void *counter(void *arg);
+static void *worker(void *arg);
+static void editchunk(job *jb, chunk *c, hx_stream *st, recbuf *rb);
+static int recsink(void *ctx, const char *from, size_t len);
+static void put(recbuf *rb, const char *from, size_t len);
+
+void editrecords(const char *fn, const hx_program *prog, const char *delim,
+					size_t reclen, const char *range, const char *containing,
+					int quiet)
+{
+	job jb;
+	memset(&jb, 0, sizeof(jb));
+	jb.prog = prog;
+	jb.reclen = reclen;
+	if (!jb.reclen) jb.delim = hexbytes(delim, &jb.dlen, "--records");
+	jb.lo = 1;
+	jb.hi = UINT64_MAX;
+	if (range) parserange(range, &jb.lo, &jb.hi);
+	if (containing)
+		jb.has = hexbytes(containing, &jb.hlen, "--containing");
+
+	int ifd = (strcmp(fn, "-") == 0) ? 0 : doopen(fn, "r");
+	struct stat sb;
+	char *in = NULL;
+	size_t len = 0;
+	int mapped = (fstat(ifd, &sb) == 0 && S_ISREG(sb.st_mode));
+	if (mapped && sb.st_size) {
+		len = sb.st_size;
+		in = mmap(NULL, len, PROT_READ, MAP_SHARED, ifd, 0);
+		if (in == MAP_FAILED) {
+			perror(fn);
+			exit(EXIT_FAILURE);
+		}
+		madvise(in, len, MADV_SEQUENTIAL);
+	} else if (!mapped) {
+		in = slurp(ifd, fn, &len);
+	}
+	if (len && zio_sniff(in, len) != ZIO_PLAIN) {
+		fputs("--records can't cut compressed input\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	cutchunks(&jb, in, len);
+
+	long nw = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nw < 1) nw = 1;
+	pthread_t *tids = domalloc(nw * sizeof(pthread_t), "editrecords()");
+	long i;
+	if (jb.delim && range) {	// record numbers, counted first
+		for (i = 0; i < nw; i++) {
+			if (pthread_create(&tids[i], NULL, counter, &jb)) {
+				fputs("Could not start worker threads\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		for (i = 0; i < nw; i++) pthread_join(tids[i], NULL);
+		uint64_t first = 1;
+		size_t c;
+		for (c = 0; c < jb.nch; c++) {
+			jb.ch[c].first = first;
+			first += jb.ch[c].nrec;
+		}
+		jb.next = 0;
+	}
+	jb.window = 4 * nw;
+	pthread_mutex_init(&jb.lock, NULL);
+	pthread_cond_init(&jb.cond, NULL);
+	for (i = 0; i < nw; i++) {
+		if (pthread_create(&tids[i], NULL, worker, &jb)) {
+			fputs("Could not start worker threads\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	long count = 0;
+	size_t c;
+	for (c = 0; c < jb.nch; c++) {	// out in order as each is done
+		chunk *ch = &jb.ch[c];
+		pthread_mutex_lock(&jb.lock);
+		while (!ch->done) pthread_cond_wait(&jb.cond, &jb.lock);
+		pthread_mutex_unlock(&jb.lock);
+		if (ch->out.from) {
+			writeall(1, ch->out.from, ch->out.len);
+			free(ch->out.from);
+		} else {
+			writeall(1, ch->from, ch->len);
+		}
+		count += ch->count;
+		pthread_mutex_lock(&jb.lock);
+		jb.written++;
+		pthread_cond_broadcast(&jb.cond);
+		pthread_mutex_unlock(&jb.lock);
+	}
+	for (i = 0; i < nw; i++) pthread_join(tids[i], NULL);
+	free(tids);
+	if (mapped && len) munmap(in, len);
+	else free(in);
+	if (ifd) doclose(ifd);
+	free(jb.ch);
+	free((char *)jb.delim);
+	free((char *)jb.has);
+	if (!quiet) {
+		char *what = (hx_op(prog) == 'd') ? "deletions" : "substitutions";
+		fprintf(stdout, "Did %li %s.\n", count, what);
+	}
+} // editrecords()
+
+static void parserange(const char *range, uint64_t *lo, uint64_t *hi)
+{	/* N-M, N- to the end, or just N */
+	char *end;
+	*lo = strtoull(range, &end, 10);
+	if (end == range) *lo = 0;
+	if (*end == '-') {
+		char *cp = end + 1;
+		*hi = UINT64_MAX;
+		if (*cp) *hi = strtoull(cp, &end, 10);
+		else end = cp;
+	} else {
+		*hi = *lo;
+	}
+	if (*lo < 1 || *hi < *lo || *end) {
+		fprintf(stderr, "Bad --range, want N-M, N- or N: %s\n", range);
+		exit(EXIT_FAILURE);
+	}
+} // parserange()
+
+static char *slurp(int fd, const char *fn, size_t *len)
+{	/* a pipe has no size to map, it's read whole */
+	size_t cap = REC_CHUNK, n = 0;
+	char *buf = domalloc(cap, "slurp()");
+	while (1) {
+		if (n == cap) {
+			cap *= 2;
+			buf = realloc(buf, cap);
+			if (!buf) {
+				perror("Could not get memory in slurp()");
+				exit(EXIT_FAILURE);
+			}
+		}
+		ssize_t res = read(fd, buf + n, cap - n);
+		if (res == -1 && errno == EINTR) continue;
+		if (res == -1) {
+			perror(fn);
+			exit(EXIT_FAILURE);
+		}
+		if (res == 0) break;
+		n += res;
+	}
+	*len = n;
+	return buf;
+} // slurp()
+
+static void cutchunks(job *jb, const char *in, size_t len)
+{	/* Chunks of about REC_CHUNK, each ending on a record boundary. */
+	size_t cap = len / REC_CHUNK + 2;
+	jb->ch = domalloc(cap * sizeof(chunk), "cutchunks()");
+	size_t step = REC_CHUNK;
+	if (jb->reclen) step = (step < jb->reclen) ? jb->reclen
+						: step - step % jb->reclen;
+	size_t pos = 0;
+	while (pos < len) {
+		size_t end = (len - pos > step) ? pos + step : len;
+		if (jb->delim && end < len) {	// on past the next delimiter
+			const char *q = nextdelim(jb, in + pos, in + end, in + len);
+			end = q ? (size_t)(q - in) + jb->dlen : len;
+		}
+		if (jb->nch == cap) {
+			cap *= 2;
+			jb->ch = realloc(jb->ch, cap * sizeof(chunk));
+			if (!jb->ch) {
+				perror("Could not get memory in cutchunks()");
+				exit(EXIT_FAILURE);
+			}
+		}
+		chunk *c = &jb->ch[jb->nch++];
+		memset(c, 0, sizeof(chunk));
+		c->from = in + pos;
+		c->len = end - pos;
+		if (jb->reclen) {
+			c->first = pos / jb->reclen + 1;
+			c->nrec = (c->len + jb->reclen - 1) / jb->reclen;
+		}
+		pos = end;
+	}
+} // cutchunks()
+
+static const char *nextdelim(const job *jb, const char *base,
+								const char *p, const char *end)
+{	/* The first delimiter at or after p that reading records on from
+	 * base would find. A delimiter that can overlap itself, 0A0A say,
+	 * may be found half way through a pair, so only one that no other
+	 * overlaps from before will do. memmem() looks a vector at a time.
+	*/
+	const char *d = jb->delim;
+	size_t dlen = jb->dlen;
+	while (p < end) {
+		const char *q = memmem(p, end - p, d, dlen);
+		if (!q) return NULL;
+		const char *s = (q - base > (ptrdiff_t)dlen - 1) ? q - (dlen - 1)
+															: base;
+		for ( ; s < q; s++) {
+			if (memcmp(s, d, dlen) == 0) break;
+		}
+		if (s == q) return q;
+		p = q + 1;
+	}
+	return NULL;
+} // nextdelim()
+
+static uint64_t countrecs(const job *jb, const chunk *c)
+{
+	const char *p = c->from, *end = c->from + c->len;
+	uint64_t n = 0;
+	if (jb->dlen == 1) {
+		n = countbyte(p, c->len, jb->delim[0]);
+		p = (end[-1] == jb->delim[0]) ? end : NULL;
+	} else {
+		const char *q;
+		while ((q = memmem(p, end - p, jb->delim, jb->dlen))) {
+			n++;
+			p = q + jb->dlen;
+		}
+	}
+	if (p != end) n++;	// the last record of the input need not be delimited
+	return n;
+} // countrecs()
+
+typedef unsigned char v16 __attribute__((vector_size(16)));
+
+static uint64_t countbyte(const char *p, size_t len, unsigned char d)
+{	/* Compared 16 at a time, each lane counting up to 255 of them. GCC
+	 * makes SSE2, NEON or whatever the target has of it.
+	*/
+	uint64_t n = 0;
+	v16 dv = (v16){0} + d;
+	while (len >= 16) {
+		size_t blocks = len / 16;
+		if (blocks > 255) blocks = 255;
+		v16 acc = {0};
+		size_t i;
+		for (i = 0; i < blocks; i++) {
+			v16 v;
+			memcpy(&v, p, 16);
+			acc -= (v16)(v == dv);	// true is all ones, -1
+			p += 16;
+		}
+		for (i = 0; i < 16; i++) n += acc[i];
+		len -= blocks * 16;
+	}
+	while (len--) n += ((unsigned char)*p++ == d);
+	return n;
+} // countbyte()
+
+static void *counter(void *arg)
+{	/* workers count records in chunks taken in turn */
+	job *jb = arg;
+	while (1) {
+		size_t c = __atomic_fetch_add(&jb->next, 1, __ATOMIC_RELAXED);
+		if (c >= jb->nch) break;
+		jb->ch[c].nrec = countrecs(jb, &jb->ch[c]);
+	}
+	return NULL;
+} // counter()
+
+static void *worker(void *arg)
+{
+	job *jb = arg;
+	recbuf rb = {0};
+	hx_stream *st;
+	if (hx_stream_tail(jb->prog, 0, recsink, &rb, &st) != HX_OK) {
+		fputs("Failed to get memory in worker()\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	while (1) {
+		pthread_mutex_lock(&jb->lock);
+		while (jb->next < jb->nch && jb->next >= jb->written + jb->window)
+			pthread_cond_wait(&jb->cond, &jb->lock);
+		if (jb->next == jb->nch) {
+			pthread_mutex_unlock(&jb->lock);
+			break;
+		}
+		chunk *c = &jb->ch[jb->next++];
+		pthread_mutex_unlock(&jb->lock);
+		editchunk(jb, c, st, &rb);
+		pthread_mutex_lock(&jb->lock);
+		c->done = 1;
+		pthread_cond_broadcast(&jb->cond);
+		pthread_mutex_unlock(&jb->lock);
+	}
+	hx_stream_free(st);
+	return NULL;
+} // worker()
+
+static void editchunk(job *jb, chunk *c, hx_stream *st, recbuf *rb)
+{	/* Each record chosen is edited, the runs of bytes between go out as
+	 * they are. A chunk with none chosen is written from the input.
+	*/
+	int ranged = (jb->lo > 1 || jb->hi != UINT64_MAX);	// else unnumbered
+	if (ranged && (c->first > jb->hi || c->first + c->nrec <= jb->lo))
+		return;
+	const char *p = c->from, *end = c->from + c->len;
+	const char *raw = p;	// start of what goes out as it is
+	uint64_t r = c->first;
+	while (p < end && r <= jb->hi) {
+		const char *q;
+		size_t dl = 0;
+		if (jb->reclen) {
+			q = ((size_t)(end - p) > jb->reclen) ? p + jb->reclen : end;
+		} else {
+			q = memmem(p, end - p, jb->delim, jb->dlen);
+			if (q) dl = jb->dlen;
+			else q = end;
+		}
+		if ((!ranged || r >= jb->lo) &&
+			(!jb->has || memmem(p, q - p, jb->has, jb->hlen))) {
+			put(rb, raw, p - raw);
+			hx_record(st, p, q - p);	// recsink() can't fail
+			c->count += hx_count(st);
+			raw = q;
+		}
+		p = q + dl;
+		r++;
+	}
+	if (raw == c->from) return;	// nothing chosen after all
+	put(rb, raw, end - raw);
+	c->out = *rb;
+	memset(rb, 0, sizeof(recbuf));
+} // editchunk()
+
+static int recsink(void *ctx, const char *from, size_t len)
+{
+	recbuf *rb = ctx;
+	if (from) {
+		put(rb, from, len);
+	} else {	// no holes in mapped input, but all the same
+		put(rb, NULL, len);
+	}
+	return 0;
+} // recsink()
+
+static void put(recbuf *rb, const char *from, size_t len)
+{	/* from NULL puts len 0x00 */
+	if (rb->len + len > rb->cap) {
+		size_t cap = rb->cap ? rb->cap : 2 * REC_CHUNK;
+		while (cap < rb->len + len) cap *= 2;
+		rb->from = realloc(rb->from, cap);
+		if (!rb->from) {
+			perror("Could not get memory in put()");
+			exit(EXIT_FAILURE);
+		}
+		rb->cap = cap;
+	}
+	if (from) {
+		memcpy(rb->from + rb->len, from, len);
+	} else {
+		memset(rb->from + rb->len, 0, len);
+	}
+	rb->len += len;
+} // put()
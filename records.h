@@ -0,0 +1,35 @@
+/*      records.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _RECORDS_H
+#define _RECORDS_H
+#include <stddef.h>
+#include "libhexsed.h"
+
+#define REC_CHUNK (1024 * 1024)	// about this much input to a worker at once
+
+void editrecords(const char *fn, const hx_program *prog, const char *delim,
+					size_t reclen, const char *range, const char *containing,
+					int quiet);
+// The edit run record by record, records ending in the hex delim or, when
+// delim is NULL, each reclen bytes long. range and containing, either may
+// be NULL, pick the records edited; the rest go through as they are.
+
+#endif
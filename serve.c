@@ -0,0 +1,325 @@
+/*      serve.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* hexsed --serve, a long running hexsed listening on a Unix socket.
+ * Compiled programs are kept in a cache keyed by a hash of the
+ * expression so each is only compiled once. A fixed pool of worker
+ * threads all accept() on the one socket and each looks after its
+ * connection until the client closes it.
+*/
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <pthread.h>
+#include "fileops.h"
+#include "libhexsed.h"
+#include "serve.h"
+
+#define NCACHE 256	// direct mapped, a clash evicts
+#define MAXFDS 16	// room to take in, and close, more than the two wanted
+
+typedef struct centry {
+	uint64_t hash;
+	char *expr;
+	hx_program *prog;
+	int refs;	// workers running it right now
+} centry;
+
+typedef struct outbuf {	// inline output collects here
+	char *from;
+	size_t len;
+	size_t cap;
+} outbuf;
+
+static centry cache[NCACHE];
+static pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *worker(void *arg);
+static void serveconn(int cfd);
+static int getprog(const char *expr, hx_program **prog);
+static void putprog(hx_program *prog);
+static uint64_t hashexpr(const char *expr);
+static void takefds(struct msghdr *mh, int *fds);
+static void closefds(int *fds);
+static int readn(int fd, void *buf, size_t len);
+static int writen(int fd, const void *buf, size_t len);
+static int bufsink(void *ctx, const char *from, size_t len);
+
+void serve(const char *sockpath)
+{	/* never returns */
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlen(sockpath) >= sizeof(sa.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", sockpath);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(sa.sun_path, sockpath);
+	struct stat sb;
+	if (stat(sockpath, &sb) == 0 && S_ISSOCK(sb.st_mode)) {
+		unlink(sockpath);	// left over from a previous run
+	}
+	int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd == -1 || bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) == -1
+		|| listen(lfd, SOMAXCONN) == -1) {
+		perror(sockpath);
+		exit(EXIT_FAILURE);
+	}
+	chmod(sockpath, S_IRUSR|S_IWUSR);
+	signal(SIGPIPE, SIG_IGN);	// a client going away is not our death
+	long nw = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nw < 2) nw = 2;
+	long i;
+	for (i = 0; i < nw; i++) {
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, worker, &lfd)) {
+			fputs("Could not start worker threads\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(tid);
+	}
+	while (1) pause();
+} // serve()
+
+static void *worker(void *arg)
+{
+	int lfd = *(int *)arg;
+	while (1) {
+		int cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+		if (cfd == -1) {
+			if (errno != EINTR && errno != ECONNABORTED) perror("accept()");
+			continue;
+		}
+		serveconn(cfd);
+		close(cfd);
+	}
+	return NULL;
+} // worker()
+
+static void serveconn(int cfd)
+{	/* one request after another until the client hangs up or sends
+	 * something that isn't a request.
+	*/
+	outbuf ob = {0};
+	char *expr = NULL;
+	const size_t chunk = 256 * 1024;
+	char *buf = malloc(chunk);
+	while (buf) {
+		hxs_req rq;
+		int fds[2] = {-1, -1};
+		char cbuf[CMSG_SPACE(MAXFDS * sizeof(int))];
+		struct iovec iov = { &rq, sizeof(rq) };
+		struct msghdr mh;
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+		mh.msg_control = cbuf;
+		mh.msg_controllen = sizeof(cbuf);
+		ssize_t n = recvmsg(cfd, &mh, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+		takefds(&mh, fds);
+		if (n != sizeof(rq)) {
+			closefds(fds);
+			break;
+		}
+		hxs_rep rp = { HXS_RMAGIC, HX_OK, 0, 0 };
+		int inl = (rq.flags & HXS_INLINE);
+		if (rq.magic != HXS_MAGIC || (!inl && fds[1] == -1) ||
+			rq.exprlen > HXS_MAXEXPR ||
+			(inl && rq.paylen > HXS_MAXINLINE)) {
+			closefds(fds);
+			rp.status = HX_EPROTO;
+			writen(cfd, &rp, sizeof(rp));
+			break;
+		}
+		char *ep = realloc(expr, rq.exprlen + 1);
+		if (ep) expr = ep;
+		if (!ep || readn(cfd, expr, rq.exprlen)) {
+			closefds(fds);
+			break;
+		}
+		expr[rq.exprlen] = '\0';
+		hx_program *prog = NULL;
+		rp.status = getprog(expr, &prog);
+		if (inl) {
+			/* the payload is fed as it arrives, only the output is
+			 * collected, it has to be counted before it's sent. */
+			hx_stream *st = NULL;
+			ob.len = 0;
+			if (rp.status == HX_OK)
+				rp.status = hx_stream_new(prog, bufsink, &ob, &st);
+			uint64_t left = rq.paylen;
+			while (left) {
+				size_t want = (left < chunk) ? left : chunk;
+				if (readn(cfd, buf, want)) {
+					rp.status = HX_EPROTO;	// client went away
+					break;
+				}
+				if (rp.status == HX_OK) rp.status = hx_feed(st, buf, want);
+				left -= want;
+			}
+			if (rp.status == HX_OK) rp.status = hx_flush(st);
+			if (st) rp.count = hx_count(st);
+			if (rp.status == HX_OK) rp.outlen = ob.len;
+			hx_stream_free(st);
+		} else if (rp.status == HX_OK) {
+			long count = 0;
+			rp.status = hx_exec_fd(prog, fds[0], fds[1], &count);
+			rp.count = count;
+		}
+		closefds(fds);
+		if (prog) putprog(prog);
+		if (rp.status == HX_EPROTO) break;
+		if (writen(cfd, &rp, sizeof(rp))) break;
+		if (rp.outlen && writen(cfd, ob.from, ob.len)) break;
+	}
+	free(buf);
+	free(expr);
+	free(ob.from);
+} // serveconn()
+
+static int getprog(const char *expr, hx_program **prog)
+{	/* a cached program if there is one, else compile and cache it */
+	uint64_t h = hashexpr(expr);
+	centry *ce = &cache[h % NCACHE];
+	pthread_mutex_lock(&cachelock);
+	if (ce->prog && ce->hash == h && strcmp(ce->expr, expr) == 0) {
+		ce->refs++;
+		*prog = ce->prog;
+		pthread_mutex_unlock(&cachelock);
+		return HX_OK;
+	}
+	pthread_mutex_unlock(&cachelock);
+	int res = hx_compile(expr, prog);
+	if (res != HX_OK) return res;	// and *prog is NULL
+	char *dup = strdup(expr);
+	pthread_mutex_lock(&cachelock);
+	if (dup && ce->refs == 0) {	// nobody is running what is there
+		hx_free(ce->prog);
+		free(ce->expr);
+		ce->hash = h;
+		ce->expr = dup;
+		ce->prog = *prog;
+		ce->refs = 1;
+		dup = NULL;
+	}
+	pthread_mutex_unlock(&cachelock);
+	free(dup);
+	return HX_OK;
+} // getprog()
+
+static void putprog(hx_program *prog)
+{	/* done with prog, free it if it never made it into the cache */
+	pthread_mutex_lock(&cachelock);
+	int i;
+	for (i = 0; i < NCACHE; i++) {
+		if (cache[i].prog == prog) {
+			cache[i].refs--;
+			pthread_mutex_unlock(&cachelock);
+			return;
+		}
+	}
+	pthread_mutex_unlock(&cachelock);
+	hx_free(prog);
+} // putprog()
+
+static uint64_t hashexpr(const char *expr)
+{	/* FNV-1a */
+	uint64_t h = 14695981039346656037ULL;
+	while (*expr) {
+		h ^= (unsigned char)*expr++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+} // hashexpr()
+
+static void takefds(struct msghdr *mh, int *fds)
+{	/* The input and output fds that came with a request, from the one
+	 * SCM_RIGHTS that carries exactly two. Every other fd that came is
+	 * closed, a bad request must not leave any open here.
+	*/
+	struct cmsghdr *cm;
+	for (cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+			continue;
+		size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int), i;
+		int keep = (n == 2 && fds[0] == -1);
+		for (i = 0; i < n; i++) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+			if (keep) fds[i] = fd;
+			else close(fd);
+		}
+	}
+} // takefds()
+
+static void closefds(int *fds)
+{
+	if (fds[0] != -1) close(fds[0]);
+	if (fds[1] != -1) close(fds[1]);
+	fds[0] = fds[1] = -1;
+} // closefds()
+
+static int readn(int fd, void *buf, size_t len)
+{	/* 0 once all len bytes are in, -1 on error or end of file */
+	char *p = buf;
+	while (len) {
+		ssize_t n = read(fd, p, len);
+		if (n == -1 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+} // readn()
+
+static int writen(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+} // writen()
+
+static int bufsink(void *ctx, const char *from, size_t len)
+{
+	outbuf *ob = ctx;
+	if (len > HXS_MAXINLINE - ob->len) return -1;	// see serve.h
+	if (ob->len + len > ob->cap) {
+		size_t cap = ob->cap ? ob->cap : 64 * 1024;
+		while (cap < ob->len + len) cap *= 2;
+		char *p = realloc(ob->from, cap);
+		if (!p) return -1;
+		ob->from = p;
+		ob->cap = cap;
+	}
+	if (from) {
+		memcpy(ob->from + ob->len, from, len);
+	} else {
+		memset(ob->from + ob->len, 0, len);
+	}
+	ob->len += len;
+	return 0;
+} // bufsink()
@@ -0,0 +1,61 @@
+/*      serve.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _SERVE_H
+#define _SERVE_H
+#include <stdint.h>
+
+/* The --serve protocol, over a local SOCK_STREAM socket so everything
+ * is in host byte order. A connection may carry any number of requests
+ * one after the other. Each request is an hxs_req followed by exprlen
+ * bytes of expression, no terminating '\0'.
+ * With HXS_INLINE set paylen bytes of input follow, and the reply is an
+ * hxs_rep followed by outlen bytes of edited output. The output is held
+ * until the input is done, so neither may be over HXS_MAXINLINE: a longer
+ * paylen is refused with HX_EPROTO, a longer output with HX_ESINK and
+ * outlen 0. Bigger jobs pass fds.
+ * Otherwise the hxs_req must carry two fds as SCM_RIGHTS, input then
+ * output. The input is edited straight to the output fd and the reply
+ * is just the hxs_rep, outlen 0.
+*/
+#define HXS_MAGIC 0x51525848	// "HXRQ"
+#define HXS_RMAGIC 0x50525848	// "HXRP"
+#define HXS_INLINE 1
+#define HXS_MAXEXPR (1024 * 1024)	// longer is refused, HX_EPROTO
+#define HXS_MAXINLINE (64 * 1024 * 1024)	// inline input or output, at most
+
+typedef struct hxs_req {
+	uint32_t magic;
+	uint32_t flags;
+	uint32_t exprlen;
+	uint32_t pad;
+	uint64_t paylen;
+} hxs_req;
+
+typedef struct hxs_rep {
+	uint32_t magic;
+	int32_t status;	// HX_OK or one of HX_E*
+	int64_t count;	// edits done
+	uint64_t outlen;
+} hxs_rep;
+
+void serve(const char *sockpath);
+
+#endif
@@ -0,0 +1,157 @@
+/*      uring.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+/* Just enough io_uring to keep a handful of reads or writes in flight
+ * from one thread. Talks to the kernel directly so there is no build
+ * dependency on liburing. Each ring is used by one thread only.
+*/
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+#include "fileops.h"
+#include "uring.h"
+
+int ur_init(uring *u, unsigned entries)
+{	/* returns -1 when the kernel has no io_uring, or it is blocked,
+	 * and the caller should use plain read()/write() instead.
+	*/
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	memset(u, 0, sizeof(uring));
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd == -1) return -1;
+	u->sqringsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cqringsz = p.cq_off.cqes + p.cq_entries *
+					sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cqringsz > u->sqringsz) u->sqringsz = u->cqringsz;
+	}
+	u->sqring = mmap(NULL, u->sqringsz, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sqring == MAP_FAILED) goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cqring = u->sqring;
+	} else {
+		u->cqring = mmap(NULL, u->cqringsz, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cqring == MAP_FAILED) goto fail;
+	}
+	u->sqessz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqessz, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) goto fail;
+	char *sq = u->sqring;
+	u->sqhead = (unsigned *)(sq + p.sq_off.head);
+	u->sqtail = (unsigned *)(sq + p.sq_off.tail);
+	u->sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sqarray = (unsigned *)(sq + p.sq_off.array);
+	char *cq = u->cqring;
+	u->cqhead = (unsigned *)(cq + p.cq_off.head);
+	u->cqtail = (unsigned *)(cq + p.cq_off.tail);
+	u->cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+fail:
+	close(u->fd);
+	return -1;
+} // ur_init()
+
+void ur_register(uring *u, struct iovec *iov, unsigned nr)
+{	/* Pin the buffers once up front. If that is refused, eg by
+	 * RLIMIT_MEMLOCK, carry on with the unregistered ops.
+	*/
+	int res = syscall(__NR_io_uring_register, u->fd,
+						IORING_REGISTER_BUFFERS, iov, nr);
+	u->fixed = (res == 0);
+} // ur_register()
+
+void ur_prep(uring *u, int write, int fd, void *buf, unsigned len,
+				off_t off, int bufidx, unsigned long long tag)
+{	/* queue one read or write, ur_submit() hands it to the kernel. */
+	unsigned tail = *u->sqtail + u->pending;
+	unsigned idx = tail & *u->sqmask;
+	struct io_uring_sqe *sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	if (u->fixed) {
+		sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->buf_index = bufidx;
+	} else {
+		sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+	}
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = off;
+	sqe->user_data = tag;
+	u->sqarray[idx] = idx;
+	u->pending++;
+} // ur_prep()
+
+void ur_submit(uring *u)
+{
+	if (!u->pending) return;
+	atomic_store_explicit((_Atomic unsigned *)u->sqtail,
+				*u->sqtail + u->pending, memory_order_release);
+	unsigned n = u->pending;
+	u->pending = 0;
+	while (n) {
+		int res = syscall(__NR_io_uring_enter, u->fd, n, 0, 0, NULL, 0);
+		if (res == -1) {
+			if (errno == EINTR || errno == EAGAIN) continue;
+			perror("io_uring_enter()");
+			exit(EXIT_FAILURE);
+		}
+		n -= res;
+	}
+} // ur_submit()
+
+int ur_wait(uring *u, unsigned long long *tag)
+{	/* block for the next completion, returns its result and sets tag
+	 * to the value given to ur_prep().
+	*/
+	while (1) {
+		unsigned head = *u->cqhead;
+		unsigned tail = atomic_load_explicit(
+				(_Atomic unsigned *)u->cqtail, memory_order_acquire);
+		if (head != tail) {
+			struct io_uring_cqe *cqe = &u->cqes[head & *u->cqmask];
+			int res = cqe->res;
+			*tag = cqe->user_data;
+			atomic_store_explicit((_Atomic unsigned *)u->cqhead,
+						head + 1, memory_order_release);
+			return res;
+		}
+		int res = syscall(__NR_io_uring_enter, u->fd, 0, 1,
+							IORING_ENTER_GETEVENTS, NULL, 0);
+		if (res == -1 && errno != EINTR) {
+			perror("io_uring_enter()");
+			exit(EXIT_FAILURE);
+		}
+	}
+} // ur_wait()
+
+void ur_exit(uring *u)
+{
+	munmap(u->sqes, u->sqessz);
+	if (u->cqring != u->sqring) munmap(u->cqring, u->cqringsz);
+	munmap(u->sqring, u->sqringsz);
+	close(u->fd);
+} // ur_exit()
@@ -0,0 +1,48 @@
+/*      uring.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _URING_H
+#define _URING_H
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+typedef struct uring {
+	int fd;
+	int fixed;	// buffers registered, use the _FIXED ops
+	unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+	unsigned *cqhead, *cqtail, *cqmask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqring, *cqring;
+	size_t sqringsz, cqringsz, sqessz;
+	unsigned pending;	// prepared but not yet submitted
+} uring;
+
+int ur_init(uring *u, unsigned entries);
+void ur_register(uring *u, struct iovec *iov, unsigned nr);
+void ur_prep(uring *u, int write, int fd, void *buf, unsigned len,
+				off_t off, int bufidx, unsigned long long tag);
+void ur_submit(uring *u);
+int ur_wait(uring *u, unsigned long long *tag);
+void ur_exit(uring *u);
+// Bare io_uring without liburing, see uring.c
+
+#endif
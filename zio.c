@@ -0,0 +1,239 @@
+/*      zio.c
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "zio.h"
+
+#define GZLEVEL 6
+#define ZSTDLEVEL 3
+
+struct zdec {
+	int fmt;
+	int ended;	// between members or frames
+	int junk;	// not another member after the last, dropped
+	int next;	// in a member that followed another
+#ifdef HAVE_ZLIB
+	z_stream gz;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *zs;
+#endif
+};
+
+int zio_sniff(const char *p, size_t len)
+{
+	const unsigned char *u = (const unsigned char *)p;
+	if (len >= 2 && u[0] == 0x1f && u[1] == 0x8b) return ZIO_GZIP;
+	if (len >= 4 && u[0] == 0x28 && u[1] == 0xb5 && u[2] == 0x2f &&
+		u[3] == 0xfd) return ZIO_ZSTD;
+	return ZIO_PLAIN;
+} // zio_sniff()
+
+int zio_have(int fmt)
+{
+	switch (fmt)
+	{
+		case ZIO_PLAIN: return 1;
+#ifdef HAVE_ZLIB
+		case ZIO_GZIP: return 1;
+#endif
+#ifdef HAVE_ZSTD
+		case ZIO_ZSTD: return 1;
+#endif
+	} // switch()
+	return 0;
+} // zio_have()
+
+int zio_byname(const char *name)
+{	/* -1 if it isn't one we know */
+	if (strcmp(name, "gzip") == 0 || strcmp(name, "gz") == 0)
+		return ZIO_GZIP;
+	if (strcmp(name, "zstd") == 0 || strcmp(name, "zst") == 0)
+		return ZIO_ZSTD;
+	return -1;
+} // zio_byname()
+
+const char *zio_name(int fmt)
+{
+	switch (fmt)
+	{
+		case ZIO_GZIP: return "gzip";
+		case ZIO_ZSTD: return "zstd";
+	} // switch()
+	return "plain";
+} // zio_name()
+
+zdec *zdec_new(int fmt)
+{	/* NULL if fmt isn't built in or there's no memory */
+	if (!zio_have(fmt) || fmt == ZIO_PLAIN) return NULL;
+	zdec *zd = calloc(1, sizeof(zdec));
+	if (!zd) return NULL;
+	zd->fmt = fmt;
+#ifdef HAVE_ZLIB
+	if (fmt == ZIO_GZIP && inflateInit2(&zd->gz, 15 + 16) != Z_OK) {
+		free(zd);
+		return NULL;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (fmt == ZIO_ZSTD) {
+		zd->zs = ZSTD_createDStream();
+		if (!zd->zs) {
+			free(zd);
+			return NULL;
+		}
+	}
+#endif
+	return zd;
+} // zdec_new()
+
+int zdec_step(zdec *zd, const char **in, size_t *inlen, char *out,
+				size_t *outlen, size_t cap)
+{
+#ifdef HAVE_ZLIB
+	if (zd->fmt == ZIO_GZIP) {
+		z_stream *z = &zd->gz;
+		z->next_in = (Bytef *)*in;
+		z->avail_in = *inlen;
+		z->next_out = (Bytef *)out + *outlen;
+		z->avail_out = cap - *outlen;
+		while (z->avail_out && !zd->junk) {
+			if (zd->ended) {
+				if (!z->avail_in) break;
+				/* Padding or garbage after the last member is dropped,
+				 * as gzip(1) does. A lone 0x1f can't be told yet, it is
+				 * fed on and a bad header there is junk too.
+				*/
+				const unsigned char *u = z->next_in;
+				if (u[0] != 0x1f || (z->avail_in > 1 && u[1] != 0x8b)) {
+					zd->junk = 1;
+					break;
+				}
+				inflateReset(z);	// another member follows
+				zd->ended = 0;
+				zd->next = 1;
+			}
+			int res = inflate(z, Z_NO_FLUSH);
+			if (res == Z_STREAM_END) zd->ended = 1;
+			else if (res == Z_BUF_ERROR) break;	// wants more input
+			else if (res == Z_DATA_ERROR && zd->next && z->total_in <= 2) {
+				zd->ended = zd->junk = 1;
+			} else if (res != Z_OK) return -1;
+		}
+		if (zd->junk) z->avail_in = 0;	// and all that comes after
+		*in = (const char *)z->next_in;
+		*inlen = z->avail_in;
+		*outlen = cap - z->avail_out;
+		return 0;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (zd->fmt == ZIO_ZSTD) {
+		ZSTD_inBuffer ib = { *in, *inlen, 0 };
+		ZSTD_outBuffer ob = { out, cap, *outlen };
+		while (ob.pos < ob.size) {
+			size_t inpos = ib.pos, outpos = ob.pos;
+			size_t res = ZSTD_decompressStream(zd->zs, &ob, &ib);
+			if (ZSTD_isError(res)) return -1;
+			zd->ended = (res == 0);
+			if (ib.pos == inpos && ob.pos == outpos) break;
+		}
+		*in += ib.pos;
+		*inlen -= ib.pos;
+		*outlen = ob.pos;
+		return 0;
+	}
+#endif
+	(void)zd; (void)in; (void)inlen; (void)out; (void)outlen; (void)cap;
+	return -1;
+} // zdec_step()
+
+int zdec_done(const zdec *zd)
+{
+	return zd->ended;
+} // zdec_done()
+
+int zdec_junk(const zdec *zd)
+{
+	return zd->junk;
+} // zdec_junk()
+
+void zdec_free(zdec *zd)
+{
+	if (!zd) return;
+#ifdef HAVE_ZLIB
+	if (zd->fmt == ZIO_GZIP) inflateEnd(&zd->gz);
+#endif
+#ifdef HAVE_ZSTD
+	if (zd->fmt == ZIO_ZSTD) ZSTD_freeDStream(zd->zs);
+#endif
+	free(zd);
+} // zdec_free()
+
+size_t zenc_bound(int fmt, size_t len)
+{
+#ifdef HAVE_ZLIB
+	if (fmt == ZIO_GZIP) return compressBound(len) + 18;	// gzip framing
+#endif
+#ifdef HAVE_ZSTD
+	if (fmt == ZIO_ZSTD) return ZSTD_compressBound(len);
+#endif
+	(void)fmt;
+	return len;
+} // zenc_bound()
+
+size_t zenc_block(int fmt, const char *in, size_t len, char *out,
+					size_t cap)
+{
+#ifdef HAVE_ZLIB
+	if (fmt == ZIO_GZIP) {
+		z_stream z;
+		memset(&z, 0, sizeof(z));
+		if (deflateInit2(&z, GZLEVEL, Z_DEFLATED, 15 + 16, 8,
+							Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+		z.next_in = (Bytef *)in;
+		z.avail_in = len;
+		z.next_out = (Bytef *)out;
+		z.avail_out = cap;
+		int res = deflate(&z, Z_FINISH);
+		size_t n = cap - z.avail_out;
+		deflateEnd(&z);
+		return (res == Z_STREAM_END) ? n : 0;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (fmt == ZIO_ZSTD) {
+		size_t n = ZSTD_compress(out, cap, in, len, ZSTDLEVEL);
+		return ZSTD_isError(n) ? 0 : n;
+	}
+#endif
+	(void)fmt; (void)in; (void)len; (void)out; (void)cap;
+	return 0;
+} // zenc_block()
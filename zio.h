@@ -0,0 +1,62 @@
+/*      zio.h
+ *
+ *	Copyright 2016 Bob Parker rlp1938@gmail.com
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *	MA 02110-1301, USA.
+*/
+
+#ifndef _ZIO_H
+#define _ZIO_H
+#include <stddef.h>
+
+/* gzip and zstd for the pipeline, each there only if configure found
+ * its library. Input formats are told apart by their magic bytes.
+*/
+#define ZIO_PLAIN 0
+#define ZIO_GZIP 1
+#define ZIO_ZSTD 2
+#define ZIO_MAGICLEN 4	// enough of the input to tell them apart
+
+int zio_sniff(const char *p, size_t len);
+int zio_have(int fmt);
+int zio_byname(const char *name);
+const char *zio_name(int fmt);
+// Format from the first bytes, built in?, and names for the user.
+
+typedef struct zdec zdec;
+zdec *zdec_new(int fmt);
+int zdec_step(zdec *zd, const char **in, size_t *inlen, char *out,
+				size_t *outlen, size_t cap);
+int zdec_done(const zdec *zd);
+int zdec_junk(const zdec *zd);
+void zdec_free(zdec *zd);
+/* Streaming decompression. zdec_step() takes what it can of in and
+ * appends to out until out holds cap bytes, returns -1 if the input is
+ * not valid. Concatenated gzip members or zstd frames are one stream.
+ * zdec_done() is non zero if the input read so far ends cleanly.
+ * zdec_junk() is non zero if what followed the last gzip member was not
+ * another member and was dropped, the caller may want to say so.
+*/
+
+size_t zenc_bound(int fmt, size_t len);
+size_t zenc_block(int fmt, const char *in, size_t len, char *out,
+					size_t cap);
+/* Compress one block as a complete gzip member or zstd frame, so that
+ * blocks done in parallel join up into one valid stream. Returns the
+ * compressed length, 0 on failure.
+*/
+
+#endif